@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "game.hpp"
+#include "probability.hpp"
+#include "protocol.hpp"
+#include "strategy.hpp"
+
+//Microbenchmarks for the code on the server's hot path. Every benchmark is
+//seeded, so two runs on the same machine do the same work.
+//
+//    bench [--iterations N] [FILTER]
+//
+//Runs each benchmark whose name contains FILTER (all by default) five
+//times and prints the fastest time per operation.
+namespace {
+    //Keeps the optimizer from dropping a result nobody reads.
+    template <typename Value>
+    void keep(const Value& value) {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    //xorshift64*, as in game.hpp
+    struct Random {
+        std::uint64_t state;
+
+        std::uint64_t next() {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            return state * 0x2545F4914F6CDD1Dull;
+        }
+        unsigned below(const unsigned bound) {
+            return static_cast<unsigned>(((next() >> 32) * bound) >> 32);
+        }
+    };
+
+    Game::Hand randomHand(Random& random, const unsigned dice) {
+        Game::Hand hand {0};
+        for (unsigned die {0}; die < dice; ++die) {
+            hand += Game::Hand{1} << (Game::laneBits * random.below(Game::faceCount));
+        }
+        return hand;
+    }
+
+    //Plays a whole game of seats bots making the likeliest bids.
+    unsigned playGame(const std::uint64_t seed, const unsigned seats) {
+        Game::Table table {seed, static_cast<std::uint8_t>(seats), 0};
+        for (unsigned seat {0}; seat < seats; ++seat) {
+            table.seat();
+        }
+        table.start();
+        unsigned moves {0};
+        while (table.currentPhase() != Game::Phase::GAME_OVER) {
+            const unsigned turn {table.currentTurn()};
+            const Probability::Move move {Probability::bestMove(table, turn)};
+            if (move.challenge) {
+                table.challenge(turn);
+                if (table.currentPhase() == Game::Phase::ROUND_OVER) {
+                    table.startRound();
+                }
+            }
+            else {
+                table.bid(turn, move.count, move.face);
+            }
+            ++moves;
+        }
+        return moves;
+    }
+
+    struct Benchmark {
+        const char* name;
+        //Runs the operation iterations times; returns how many operations
+        //that was, if it is not one per iteration.
+        std::uint64_t (*run)(std::uint64_t iterations);
+    };
+
+    const Benchmark benchmarks[] {
+        {"protocol/encode-round", [](const std::uint64_t iterations) {
+            std::vector<std::uint8_t> out;
+            for (std::uint64_t i {0}; i < iterations; ++i) {
+                out.clear();
+                Protocol::encode(out, Protocol::BidMade{
+                        .seat = 1, .count = 3, .face = 4});
+                Protocol::encode(out, Protocol::RoundStarted{
+                        .round = static_cast<std::uint16_t>(i),
+                        .turn = 2,
+                        .diceCounts = 0x6DB,
+                        .hand = 0x108421});
+                keep(out.data());
+            }
+            return iterations;
+        }},
+        {"protocol/decode-frame", [](const std::uint64_t iterations) {
+            //What a client sees after a challenge at a full table.
+            std::vector<std::uint8_t> frame;
+            Protocol::encode(frame, Protocol::ChallengeResult{
+                    .challenger = 1, .bidder = 0, .actual = 7, .loser = 1});
+            for (std::uint8_t seat {0}; seat < Game::maxSeats; ++seat) {
+                Protocol::encode(frame, Protocol::DiceReveal{
+                        .seat = seat, .hand = 0x108421});
+            }
+            std::uint64_t messages {0};
+            for (std::uint64_t i {0}; i < iterations; ++i) {
+                keep(frame.data());
+                const Protocol::Frame view {frame};
+                if (!view.wellFormed()) {
+                    std::abort();
+                }
+                for (const Protocol::View& message : view) {
+                    if (const auto reveal {
+                            Protocol::decode<Protocol::DiceReveal>(message)}) {
+                        keep(reveal->hand);
+                    }
+                    ++messages;
+                }
+            }
+            return messages;
+        }},
+        {"game/bid", [](const std::uint64_t iterations) {
+            Game::Table table {1, Game::maxSeats, 0};
+            for (unsigned seat {0}; seat < Game::maxSeats; ++seat) {
+                table.seat();
+            }
+            table.start();
+            for (std::uint64_t i {0}; i < iterations; ++i) {
+                //Climb the ladder, then start over at the bottom.
+                unsigned count {table.currentBidCount()};
+                unsigned face {table.currentBidFace() + 1};
+                if (count == 0 || face > Game::faceCount) {
+                    ++count;
+                    face = 1;
+                }
+                if (count > table.totalDice()) {
+                    table.startRound();
+                    count = 1;
+                }
+                keep(table.bid(table.currentTurn(), count, face));
+            }
+            return iterations;
+        }},
+        {"game/heads-up-game", [](const std::uint64_t iterations) {
+            std::uint64_t moves {0};
+            for (std::uint64_t i {0}; i < iterations; ++i) {
+                moves += playGame(i + 1, 2);
+            }
+            keep(moves);
+            return iterations;
+        }},
+        {"game/full-table-game", [](const std::uint64_t iterations) {
+            std::uint64_t moves {0};
+            for (std::uint64_t i {0}; i < iterations; ++i) {
+                moves += playGame(i + 1, Game::maxSeats);
+            }
+            keep(moves);
+            return iterations;
+        }},
+        {"probability/score-bids", [](const std::uint64_t iterations) {
+            Random random {1};
+            Probability::BidScores scores;
+            for (std::uint64_t i {0}; i < iterations; ++i) {
+                Probability::scoreBids(
+                        randomHand(random, Game::startingDice),
+                        25,
+                        static_cast<std::uint8_t>(i & 1),
+                        scores);
+                keep(scores);
+            }
+            return iterations;
+        }},
+        {"probability/best-move", [](const std::uint64_t iterations) {
+            Game::Table table {1, Game::maxSeats, Game::Rules::WILD_ONES};
+            for (unsigned seat {0}; seat < Game::maxSeats; ++seat) {
+                table.seat();
+            }
+            table.start();
+            table.bid(table.currentTurn(), 4, 3);
+            for (std::uint64_t i {0}; i < iterations; ++i) {
+                keep(Probability::bestMove(table, table.currentTurn()));
+            }
+            return iterations;
+        }},
+        {"strategy/hand-rank", [](const std::uint64_t iterations) {
+            Random random {1};
+            unsigned ranks {0};
+            for (std::uint64_t i {0}; i < iterations; ++i) {
+                ranks += Strategy::handRank(
+                        randomHand(random, Game::startingDice),
+                        Game::startingDice);
+            }
+            keep(ranks);
+            return iterations;
+        }},
+    };
+}
+
+int main(int argc, char* argv[]) {
+    std::uint64_t iterations {1000000};
+    std::string filter {};
+    for (int i {1}; i < argc; ++i) {
+        const std::string argument {argv[i]};
+        if (argument == "--iterations" && i + 1 < argc) {
+            iterations = std::max<std::uint64_t>(
+                    std::strtoull(argv[++i], nullptr, 10), 1);
+        }
+        else {
+            filter = argument;
+        }
+    }
+
+    for (const Benchmark& benchmark : benchmarks) {
+        if (std::string{benchmark.name}.find(filter) == std::string::npos) {
+            continue;
+        }
+        //Whole games are thousands of times slower than the rest.
+        const std::uint64_t count {
+                std::string{benchmark.name}.ends_with("game")
+              ? std::max<std::uint64_t>(iterations / 1000, 1)
+              : iterations};
+        double best {0};
+        for (unsigned run {0}; run < 5; ++run) {
+            const auto start {std::chrono::steady_clock::now()};
+            const std::uint64_t operations {benchmark.run(count)};
+            const std::chrono::duration<double, std::nano> elapsed {
+                    std::chrono::steady_clock::now() - start};
+            const double perOperation {elapsed.count() / operations};
+            best = run == 0 ? perOperation : std::min(best, perOperation);
+        }
+        std::printf("%-26s %12.1f ns/op\n", benchmark.name, best);
+    }
+    return 0;
+}
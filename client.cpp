@@ -1,13 +1,19 @@
+#include <algorithm>
+#include <array>
 #include <cmath>
+#include <cstdint>
 #include <cstdio>
 #include <initializer_list>
 #include <string>
+#include <variant>
+#include <vector>
 #ifdef __EMSCRIPTEN__
     #include <emscripten.h>
     #include <emscripten/websocket.h>
 #endif
 #include <SDL.h>
 #include <SDL_ttf.h>
+#include "protocol.hpp"
 
 namespace SocketWrapper {
     bool isSupported() {
@@ -18,6 +24,19 @@ namespace SocketWrapper {
             return true;
         #endif
     }
+
+    #ifdef __EMSCRIPTEN__
+        //Sends everything encoded into outbound as one frame.
+        void flush(
+                const EMSCRIPTEN_WEBSOCKET_T websocket,
+                std::vector<std::uint8_t>& outbound) {
+            if (!outbound.empty()) {
+                emscripten_websocket_send_binary(
+                        websocket, outbound.data(), outbound.size());
+                outbound.clear();
+            }
+        }
+    #endif
 }
 
 class Client {
@@ -55,13 +74,183 @@ class Client {
                     else {
                         return SDL_Rect{
                                 .x = static_cast<int>(x),
-                                .y = static_cast<int>(x),
+                                .y = static_cast<int>(y),
                                 .w = static_cast<int>(width),
                                 .h = static_cast<int>(height)};
                     }
                 }
         };
 
+        //Printable ASCII rendered once, in white, into a single texture.
+        //Text is drawn as quads sampling it, tinted per vertex, so drawing
+        //never rasterizes or uploads anything.
+        class GlyphAtlas {
+            private:
+                static constexpr char first {' '};
+                static constexpr char last {'~'};
+
+                SDL_Texture* texture {nullptr};
+                std::array<SDL_Rect, last - first + 1> glyphs {};
+                std::array<int, last - first + 1> advances {};
+                int lineHeight {0};
+
+            public:
+                GlyphAtlas() = default;
+                GlyphAtlas(const GlyphAtlas&) = delete;
+                GlyphAtlas& operator=(const GlyphAtlas&) = delete;
+                ~GlyphAtlas() {
+                    release();
+                }
+
+                void release() {
+                    if (texture != nullptr) {
+                        SDL_DestroyTexture(texture);
+                        texture = nullptr;
+                    }
+                }
+
+                bool build(SDL_Renderer* renderer, TTF_Font* font) {
+                    release();
+                    if (font == nullptr) {
+                        return false;
+                    }
+                    constexpr SDL_Color white {
+                            .r = 255, .g = 255, .b = 255, .a = 255};
+                    std::array<SDL_Surface*, last - first + 1> rendered {};
+                    int width {0};
+                    lineHeight = TTF_FontHeight(font);
+                    for (char c {first}; c <= last; ++c) {
+                        SDL_Surface*& surface {rendered[c - first]};
+                        surface = TTF_RenderGlyph_Blended(font, c, white);
+                        int advance {0};
+                        TTF_GlyphMetrics(
+                                font, c, nullptr, nullptr, nullptr, nullptr,
+                                &advance);
+                        advances[c - first] = advance;
+                        if (surface != nullptr) {
+                            //1px gap so linear filtering never bleeds.
+                            width += surface->w + 1;
+                            lineHeight = std::max(lineHeight, surface->h);
+                        }
+                    }
+                    SDL_Surface* sheet {SDL_CreateRGBSurfaceWithFormat(
+                            0, width, lineHeight, 32, SDL_PIXELFORMAT_RGBA32)};
+                    int x {0};
+                    for (char c {first}; c <= last; ++c) {
+                        SDL_Surface* surface {rendered[c - first]};
+                        if (surface == nullptr) {
+                            glyphs[c - first] = {};
+                            continue;
+                        }
+                        SDL_Rect destination {
+                                .x = x, .y = 0, .w = surface->w, .h = surface->h};
+                        if (sheet != nullptr) {
+                            SDL_SetSurfaceBlendMode(surface, SDL_BLENDMODE_NONE);
+                            SDL_BlitSurface(surface, nullptr, sheet, &destination);
+                        }
+                        glyphs[c - first] = destination;
+                        x += surface->w + 1;
+                        SDL_FreeSurface(surface);
+                    }
+                    if (sheet == nullptr) {
+                        return false;
+                    }
+                    texture = SDL_CreateTextureFromSurface(renderer, sheet);
+                    SDL_FreeSurface(sheet);
+                    if (texture == nullptr) {
+                        return false;
+                    }
+                    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+                    //Glyphs are drawn scaled to any size near the bucket's.
+                    SDL_SetTextureScaleMode(texture, SDL_ScaleModeLinear);
+                    return true;
+                }
+
+                SDL_Texture* getTexture() const {
+                    return texture;
+                }
+                int getLineHeight() const {
+                    return lineHeight;
+                }
+                //Unknown characters draw as '?'.
+                const SDL_Rect& glyph(const char c) const {
+                    return glyphs[(c < first || c > last ? '?' : c) - first];
+                }
+                int advance(const char c) const {
+                    return advances[(c < first || c > last ? '?' : c) - first];
+                }
+        };
+
+        //One atlas per size bucket, all rasterized at startup. Text of any
+        //pixel height samples the smallest bucket at least that tall and is
+        //scaled down to fit, so resizing the window only moves vertices; the
+        //font is never reloaded or re-rasterized.
+        class Font {
+            private:
+                static constexpr std::array<int, 7> pointSizes {
+                        12, 18, 24, 36, 48, 72, 96};
+
+                std::array<GlyphAtlas, pointSizes.size()> atlases {};
+
+            public:
+                bool build(SDL_Renderer* renderer, const char* path) {
+                    TTF_Font* font {TTF_OpenFont(path, pointSizes.front())};
+                    if (font == nullptr) {
+                        return false;
+                    }
+                    bool built {true};
+                    for (std::size_t i {0}; i < pointSizes.size(); ++i) {
+                        //Same face, new size: nothing is parsed again.
+                        TTF_SetFontSize(font, pointSizes[i]);
+                        built &= atlases[i].build(renderer, font);
+                    }
+                    TTF_CloseFont(font);
+                    return built;
+                }
+                void release() {
+                    for (GlyphAtlas& atlas : atlases) {
+                        atlas.release();
+                    }
+                }
+
+                const GlyphAtlas& forHeight(const int pixels) const {
+                    for (const GlyphAtlas& atlas : atlases) {
+                        if (atlas.getLineHeight() >= pixels) {
+                            return atlas;
+                        }
+                    }
+                    return atlases.back();
+                }
+        };
+
+        //A string laid out against an atlas, as ready-to-submit vertices.
+        //Rebuilt only when something in the key changes.
+        class TextLayout {
+            private:
+            public:
+                std::string text {};
+                SDL_Color color {};
+                SDL_Rect bounds {};
+                const GlyphAtlas* atlas {nullptr};
+                std::vector<SDL_Vertex> vertices {};
+                std::vector<int> indices {};
+                //Area the quads cover.
+                SDL_Rect extent {};
+
+                bool matches(
+                        const std::string& otherText,
+                        const SDL_Color& otherColor,
+                        const SDL_Rect& otherBounds,
+                        const GlyphAtlas* otherAtlas) const {
+                    return atlas == otherAtlas
+                        && bounds.x == otherBounds.x && bounds.y == otherBounds.y
+                        && bounds.w == otherBounds.w && bounds.h == otherBounds.h
+                        && color.r == otherColor.r && color.g == otherColor.g
+                        && color.b == otherColor.b && color.a == otherColor.a
+                        && text == otherText;
+                }
+        };
+
         class Text {
             private:
             public:
@@ -70,40 +259,122 @@ class Client {
                 SDL_Color color {};
                 Align horizontalAlign {Align::NEAR};
                 Align verticalAlign {Align::NEAR};
+                //Line height as a fraction of the rect's height.
+                float size {0.2f};
+                mutable TextLayout layout {};
 
-                void draw(SDL_Renderer* renderer, TTF_Font* font) const {
-                    int canvasWidth;
-                    int canvasHeight;
-                    SDL_GetRendererOutputSize(
-                            renderer, &canvasWidth, &canvasHeight);
-                    SDL_Surface* surface {TTF_RenderText_Solid(
-                            font, text.c_str(), color)};
-                    SDL_Texture* texture {SDL_CreateTextureFromSurface(
-                            renderer, surface)};
-                    SDL_Rect sdlRect {rect.toSDLRect(
-                            canvasWidth, canvasHeight)};
+                int pixelHeight(const SDL_Rect& bounds) const {
+                    return std::max(
+                            static_cast<int>(bounds.h * size + 0.5f), 1);
+                }
+
+                void lay(const SDL_Rect& bounds, const GlyphAtlas& atlas) const {
+                    //Bucket glyphs are at least as tall as wanted; shrink.
+                    const float scale {static_cast<float>(pixelHeight(bounds))
+                            / std::max(atlas.getLineHeight(), 1)};
+                    layout.text = text;
+                    layout.color = color;
+                    layout.bounds = bounds;
+                    layout.atlas = &atlas;
+                    layout.vertices.clear();
+                    layout.indices.clear();
+
+                    float advanced {0};
+                    for (const char c : text) {
+                        advanced += atlas.advance(c) * scale;
+                    }
+                    const int width {static_cast<int>(std::ceil(advanced))};
+                    const int height {pixelHeight(bounds)};
+                    SDL_Rect sdlRect {bounds};
                     switch (horizontalAlign) {
                         case Align::CENTER:
-                            sdlRect.x += (sdlRect.w - surface->w) / 2;
+                            sdlRect.x += (sdlRect.w - width) / 2;
                         break;
                         case Align::FAR: 
-                            sdlRect.x += sdlRect.w - surface->w;
+                            sdlRect.x += sdlRect.w - width;
                         break;
                     }
                     switch (verticalAlign) {
                         case Align::CENTER:
-                            sdlRect.y += (sdlRect.h - surface->h) / 2;
+                            sdlRect.y += (sdlRect.h - height) / 2;
                         break;
                         case Align::FAR: 
-                            sdlRect.y += sdlRect.h - surface->h;
+                            sdlRect.y += sdlRect.h - height;
                         break;
                     }
-                    sdlRect.w = surface->w;
-                    sdlRect.h = surface->h;
-                    SDL_RenderCopy(
-                            //                 src=full dst
-                            renderer, texture, nullptr, &sdlRect);
-                    SDL_FreeSurface(surface);
+
+                    layout.extent = {
+                            .x = sdlRect.x, .y = sdlRect.y,
+                            .w = width, .h = height};
+
+                    int textureWidth {0};
+                    int textureHeight {0};
+                    SDL_QueryTexture(
+                            atlas.getTexture(), nullptr, nullptr,
+                            &textureWidth, &textureHeight);
+                    float x {static_cast<float>(sdlRect.x)};
+                    const float y {static_cast<float>(sdlRect.y)};
+                    for (const char c : text) {
+                        const SDL_Rect& glyph {atlas.glyph(c)};
+                        if (glyph.w > 0 && textureWidth > 0) {
+                            const float u0 {static_cast<float>(glyph.x) / textureWidth};
+                            const float u1 {static_cast<float>(glyph.x + glyph.w) 
+                                    / textureWidth};
+                            const float v1 {static_cast<float>(glyph.h) 
+                                    / textureHeight};
+                            const int base {static_cast<int>(layout.vertices.size())};
+                            for (const auto& [dx, dy, u, v] : {
+                                    std::array<float, 4>{0, 0, u0, 0},
+                                    std::array<float, 4>{1, 0, u1, 0},
+                                    std::array<float, 4>{1, 1, u1, v1},
+                                    std::array<float, 4>{0, 1, u0, v1}}) {
+                                layout.vertices.push_back(SDL_Vertex{
+                                        .position = {
+                                                .x = x + dx * glyph.w * scale,
+                                                .y = y + dy * glyph.h * scale},
+                                        .color = color,
+                                        .tex_coord = {.x = u, .y = v}});
+                            }
+                            for (const int corner : {0, 1, 2, 0, 2, 3}) {
+                                layout.indices.push_back(base + corner);
+                            }
+                        }
+                        x += atlas.advance(c) * scale;
+                    }
+                }
+
+                //Cheap when nothing changed: the cached layout is reused
+                //unless its key differs.
+                void layOut(
+                        const int canvasWidth,
+                        const int canvasHeight,
+                        const Font& font) const {
+                    const SDL_Rect bounds {rect.toSDLRect(
+                            canvasWidth, canvasHeight)};
+                    const GlyphAtlas& atlas {font.forHeight(pixelHeight(bounds))};
+                    if (!layout.matches(text, color, bounds, &atlas)) {
+                        lay(bounds, atlas);
+                    }
+                }
+                //Everything draw() can touch; valid after layOut().
+                SDL_Rect area() const {
+                    SDL_Rect result;
+                    SDL_UnionRect(&layout.bounds, &layout.extent, &result);
+                    return result;
+                }
+
+                void draw(SDL_Renderer* renderer) const {
+                    if (layout.indices.empty()) {
+                        return;
+                    }
+                    //One call for the whole string.
+                    SDL_RenderGeometry(
+                            renderer,
+                            layout.atlas->getTexture(),
+                            layout.vertices.data(),
+                            static_cast<int>(layout.vertices.size()),
+                            layout.indices.data(),
+                            static_cast<int>(layout.indices.size()));
                 }
         };
 
@@ -117,30 +388,178 @@ class Client {
                 bool hasText {false};
                 Text text {};
 
-                void draw(SDL_Renderer* renderer, TTF_Font* font) const {
-                    int canvasWidth;
-                    int canvasHeight;
-                    SDL_GetRendererOutputSize(
-                            renderer, &canvasWidth, &canvasHeight);
-                    SDL_Rect sdlRect {rect.toSDLRect(
-                            canvasWidth, canvasHeight)};
+                mutable SDL_Rect bounds {};
+
+                void layOut(
+                        const int canvasWidth,
+                        const int canvasHeight,
+                        const Font& font) const {
+                    bounds = rect.toSDLRect(canvasWidth, canvasHeight);
+                    if (hasText) {
+                        text.layOut(canvasWidth, canvasHeight, font);
+                    }
+                }
+                SDL_Rect area() const {
+                    if (!hasText) {
+                        return bounds;
+                    }
+                    const SDL_Rect textArea {text.area()};
+                    SDL_Rect result;
+                    SDL_UnionRect(&bounds, &textArea, &result);
+                    return result;
+                }
+
+                void draw(SDL_Renderer* renderer) const {
                     SDL_SetRenderDrawColor(
                             renderer, color.r, color.g, color.b, color.a);
                     if (fill) {
-                        SDL_RenderFillRect(renderer, &sdlRect);
+                        SDL_RenderFillRect(renderer, &bounds);
                     }
                     else {
-                        SDL_RenderDrawRect(renderer, &sdlRect);
+                        SDL_RenderDrawRect(renderer, &bounds);
                     }
                     if (hasText) {
-                        text.draw(renderer, font);
+                        text.draw(renderer);
                     }
                 }
         };
 
+        //Everything a screen shows, kept between frames. Layout is cached
+        //until the canvas size changes, and only the areas of widgets
+        //marked changed are redrawn; the rest of the canvas is left as the
+        //last frame drew it.
+        class Scene {
+            private:
+                using Widget = std::variant<Button*, Text*>;
+
+                struct Entry {
+                    Widget widget;
+                    bool changed {true};
+                };
+
+                std::vector<Entry> entries {};
+                std::vector<SDL_Rect> damage {};
+                int layoutWidth {-1};
+                int layoutHeight {-1};
+                bool fullRedraw {true};
+
+                static SDL_Rect areaOf(const Widget& widget) {
+                    return std::visit([](const auto* item) {
+                        return item->area();
+                    }, widget);
+                }
+
+                //Overlapping rectangles are merged so nothing is drawn twice.
+                void addDamage(SDL_Rect rect) {
+                    if (rect.w <= 0 || rect.h <= 0) {
+                        return;
+                    }
+                    for (auto it {damage.begin()}; it != damage.end();) {
+                        if (SDL_HasIntersection(&*it, &rect)) {
+                            SDL_UnionRect(&*it, &rect, &rect);
+                            it = damage.erase(it);
+                        }
+                        else {
+                            ++it;
+                        }
+                    }
+                    damage.push_back(rect);
+                }
+
+            public:
+                void add(Button& button) {
+                    entries.push_back({.widget = &button});
+                    fullRedraw = true;
+                }
+                void add(Text& text) {
+                    entries.push_back({.widget = &text});
+                    fullRedraw = true;
+                }
+
+                //Call after changing a widget's fields.
+                template <typename Item>
+                void touch(const Item& item) {
+                    for (Entry& entry : entries) {
+                        const auto* pointer {std::get_if<Item*>(&entry.widget)};
+                        if (pointer != nullptr && *pointer == &item) {
+                            entry.changed = true;
+                        }
+                    }
+                }
+                void invalidate() {
+                    fullRedraw = true;
+                }
+
+                //Draws what changed into the current render target, which
+                //must still hold this scene's last frame unless invalidated.
+                //Returns whether anything was drawn.
+                bool render(
+                        SDL_Renderer* renderer,
+                        const Font& font,
+                        const int width,
+                        const int height) {
+                    damage.clear();
+                    if (width != layoutWidth || height != layoutHeight) {
+                        layoutWidth = width;
+                        layoutHeight = height;
+                        fullRedraw = true;
+                    }
+                    for (Entry& entry : entries) {
+                        if (fullRedraw || entry.changed) {
+                            //Both where it was and where it is now.
+                            addDamage(areaOf(entry.widget));
+                            std::visit([&](const auto* item) {
+                                item->layOut(width, height, font);
+                            }, entry.widget);
+                            addDamage(areaOf(entry.widget));
+                            entry.changed = false;
+                        }
+                    }
+                    if (fullRedraw) {
+                        damage.assign(1, SDL_Rect{
+                                .x = 0, .y = 0, .w = width, .h = height});
+                        fullRedraw = false;
+                    }
+
+                    for (const SDL_Rect& region : damage) {
+                        SDL_RenderSetClipRect(renderer, &region);
+                        SDL_SetRenderDrawColor(
+                                //        r  g  b  a
+                                renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
+                        SDL_RenderFillRect(renderer, &region);
+                        for (const Entry& entry : entries) {
+                            const SDL_Rect area {areaOf(entry.widget)};
+                            if (SDL_HasIntersection(&area, &region)) {
+                                std::visit([&](const auto* item) {
+                                    item->draw(renderer);
+                                }, entry.widget);
+                            }
+                        }
+                    }
+                    SDL_RenderSetClipRect(renderer, nullptr);
+                    return !damage.empty();
+                }
+        };
+
+        static constexpr const char* fontPath {"assets/Hack-Regular.ttf"};
+
         SDL_Window* window;
         SDL_Renderer* renderer;
-        TTF_Font* font;
+        Font font {};
+        //Persistent copy of the screen; scenes update it in place and it is
+        //copied to the window on present.
+        SDL_Texture* canvas {nullptr};
+        int canvasWidth {0};
+        int canvasHeight {0};
+        //The window needs the canvas again (exposed, resized) even if no
+        //scene has changed.
+        bool windowStale {true};
+
+        #ifdef __EMSCRIPTEN__
+            EMSCRIPTEN_WEBSOCKET_T websocket {0};
+        #endif
+        std::vector<std::uint8_t> outbound {};
+        std::uint32_t playerId {0};
 
         GameState gameState {GameState::HOME};
         //HOME:
@@ -175,23 +594,214 @@ class Client {
                         .horizontalAlign = Align::CENTER,
                         .verticalAlign = Align::CENTER}};
 
-        void draw() {
+        Scene homeScene {};
+        Scene lobbyScene {};
+        Scene ingameScene {};
+        const Scene* shownScene {nullptr};
+
+        Scene& currentScene() {
             switch (gameState) {
-                case GameState::HOME:
-                    SDL_SetRenderDrawColor(
-                            //        r  g  b  a
-                            renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
-                    SDL_RenderClear(renderer);
-                    for (const auto& button : {
-                            createGameButton,
-                            joinGameButton}) {
-                        button.draw(renderer, font);
+                case GameState::LOBBY:
+                    return lobbyScene;
+                case GameState::INGAME:
+                    return ingameScene;
+                default:
+                    return homeScene;
+            }
+        }
+
+        void draw() {
+            int width;
+            int height;
+            SDL_GetRendererOutputSize(renderer, &width, &height);
+            Scene& scene {currentScene()};
+            if (canvas == nullptr || width != canvasWidth || height != canvasHeight) {
+                if (canvas != nullptr) {
+                    SDL_DestroyTexture(canvas);
+                }
+                canvas = SDL_CreateTexture(
+                        renderer,
+                        SDL_PIXELFORMAT_RGBA8888,
+                        SDL_TEXTUREACCESS_TARGET,
+                        width,
+                        height);
+                canvasWidth = width;
+                canvasHeight = height;
+                scene.invalidate();
+            }
+            if (&scene != shownScene) {
+                scene.invalidate();
+                shownScene = &scene;
+            }
+            SDL_SetRenderTarget(renderer, canvas);
+            const bool drew {scene.render(renderer, font, width, height)};
+            SDL_SetRenderTarget(renderer, nullptr);
+            if (!drew && !windowStale) {
+                return;
+            }
+            windowStale = false;
+            SDL_RenderCopy(renderer, canvas, nullptr, nullptr);
+            SDL_RenderPresent(renderer);
+        }
+
+        //Target textures (the canvas) lose their contents on a targets
+        //reset and every texture is lost on a device reset, so both are
+        //made again and the scene drawn from scratch.
+        void onRenderReset() {
+            if (canvas != nullptr) {
+                SDL_DestroyTexture(canvas);
+                canvas = nullptr;
+            }
+            font.release();
+            font.build(renderer, fontPath);
+            shownScene = nullptr;
+            windowStale = true;
+            dirty = true;
+        }
+
+        void onMessage(const Protocol::View& view) {
+            if (view.version != Protocol::version) {
+                std::printf("%s", "server protocol version mismatch\n");
+                return;
+            }
+            switch (view.type) {
+                case Protocol::MessageType::WELCOME:
+                    if (const auto welcome {
+                            Protocol::decode<Protocol::Welcome>(view)}) {
+                        playerId = welcome->playerId;
+                        std::printf("welcomed as player %u\n", playerId);
                     }
                 break;
+                case Protocol::MessageType::ERROR:
+                    if (const auto error {
+                            Protocol::decode<Protocol::Error>(view)}) {
+                        std::printf(
+                                "server error %d\n",
+                                static_cast<int>(error->code));
+                    }
+                break;
+                default:
+                    std::printf(
+                            "unhandled message type %d\n",
+                            static_cast<int>(view.type));
+                break;
             }
-            SDL_RenderPresent(renderer);
         }
 
+        #ifdef __EMSCRIPTEN__
+            void connect(const char* url) {
+                EmscriptenWebSocketCreateAttributes attributes {
+                        url,
+                        nullptr,
+                        true};
+                websocket = emscripten_websocket_new(&attributes);
+                emscripten_websocket_set_onopen_callback(
+                        websocket,
+                        this,
+                        [](
+                        int eventType, 
+                        const EmscriptenWebSocketOpenEvent* websocketEvent,
+                        void* userData) -> EM_BOOL {
+                            Client& client {*static_cast<Client*>(userData)};
+                            Protocol::encode(
+                                    client.outbound, Protocol::Hello{});
+                            SocketWrapper::flush(
+                                    websocketEvent->socket, client.outbound);
+                            return true;
+                        });
+                emscripten_websocket_set_onerror_callback(
+                        websocket,
+                        this,
+                        [](
+                        int eventType, 
+                        const EmscriptenWebSocketErrorEvent* websocketEvent,
+                        void* userData) -> EM_BOOL {
+                            std::printf("%s", "websocket error\n");
+                            return true;
+                        });
+                emscripten_websocket_set_onclose_callback(
+                        websocket,
+                        this,
+                        [](
+                        int eventType, 
+                        const EmscriptenWebSocketCloseEvent* websocketEvent,
+                        void* userData) -> EM_BOOL {
+                            std::printf("%s", "websocket closed\n");
+                            static_cast<Client*>(userData)->websocket = 0;
+                            return true;
+                        });
+                emscripten_websocket_set_onmessage_callback(
+                        websocket,
+                        this,
+                        [](
+                        int eventType, 
+                        const EmscriptenWebSocketMessageEvent* websocketEvent,
+                        void* userData) -> EM_BOOL {
+                            Client& client {*static_cast<Client*>(userData)};
+                            if (websocketEvent->isText) {
+                                return true;
+                            }
+                            for (const Protocol::View& view : Protocol::Frame{
+                                    websocketEvent->data,
+                                    websocketEvent->numBytes}) {
+                                client.onMessage(view);
+                            }
+                            client.requestRedraw();
+                            SocketWrapper::flush(
+                                    websocketEvent->socket, client.outbound);
+                            return true;
+                        });
+            }
+        #endif
+
+        //Whether the next tick should draw: set by anything that changes what
+        //is on screen, cleared by draw().
+        bool dirty {true};
+        //Animations (dice rolls) redraw every frameBudget ms until this time.
+        std::uint32_t animatingUntil {0};
+        std::uint32_t nextFrameAt {0};
+        static constexpr std::uint32_t frameBudget {16};
+        #ifdef __EMSCRIPTEN__
+            bool paused {false};
+        #else
+            Uint32 wakeEvent {0};
+        #endif
+
+        #ifdef __EMSCRIPTEN__
+            void resume() {
+                if (paused) {
+                    paused = false;
+                    emscripten_resume_main_loop();
+                }
+            }
+            //Browser input is queued by callbacks even while the main loop
+            //is paused; this runs as each event is queued.
+            static int onEventQueued(void* userData, SDL_Event* event) {
+                static_cast<Client*>(userData)->resume();
+                return 0;
+            }
+        #endif
+
+        bool animating(const std::uint32_t now) const {
+            return static_cast<std::int32_t>(animatingUntil - now) > 0;
+        }
+
+        #ifndef __EMSCRIPTEN__
+            //Sleeps until there is an event or the next animation frame is
+            //due; returns whether event was filled.
+            bool waitForEvent(SDL_Event& event) {
+                if (dirty) {
+                    return SDL_PollEvent(&event) != 0;
+                }
+                const std::uint32_t now {SDL_GetTicks()};
+                if (animating(now)) {
+                    const auto wait {static_cast<std::int32_t>(nextFrameAt - now)};
+                    return SDL_WaitEventTimeout(&event, std::max(wait, 0)) != 0;
+                }
+                return SDL_WaitEvent(&event) != 0;
+            }
+        #endif
+
     public:
         bool finished {false};
 
@@ -209,19 +819,65 @@ class Client {
                     window,
                     -1, /* driver (default) */
                     SDL_RENDERER_ACCELERATED 
-                  | SDL_RENDERER_PRESENTVSYNC); /* flags */
-            font = TTF_OpenFont("assets/Hack-Regular.ttf", 32);
+                  | SDL_RENDERER_PRESENTVSYNC
+                  | SDL_RENDERER_TARGETTEXTURE); /* flags */
+            font.build(renderer, fontPath);
+            homeScene.add(createGameButton);
+            homeScene.add(joinGameButton);
+            #ifdef __EMSCRIPTEN__
+                SDL_AddEventWatch(onEventQueued, this);
+                if (SocketWrapper::isSupported()) {
+                    connect("wss://127.0.0.1:443");
+                }
+            #else
+                wakeEvent = SDL_RegisterEvents(1);
+            #endif
         }
         ~Client() {
+            #ifdef __EMSCRIPTEN__
+                SDL_DelEventWatch(onEventQueued, this);
+            #endif
+            if (canvas != nullptr) {
+                SDL_DestroyTexture(canvas);
+            }
+            font.release();
             TTF_Quit();
             SDL_DestroyWindow(window);
             SDL_Quit();
         }
 
+        //Safe to call from any thread, including network callbacks.
+        void requestRedraw() {
+            #ifdef __EMSCRIPTEN__
+                dirty = true;
+                resume();
+            #else
+                SDL_Event event {};
+                event.type = wakeEvent;
+                SDL_PushEvent(&event);
+            #endif
+        }
+        void animateFor(const std::uint32_t milliseconds) {
+            animatingUntil = SDL_GetTicks() + milliseconds;
+            requestRedraw();
+        }
+
         void tick() {
             SDL_Event event;
-            bool redraw {false};
-            while (SDL_PollEvent(&event)) {
+            #ifdef __EMSCRIPTEN__
+                //Called by the browser once per animation frame while the
+                //main loop runs, so there is nothing to wait for here.
+                bool gotEvent {SDL_PollEvent(&event) != 0};
+            #else
+                bool gotEvent {waitForEvent(event)};
+            #endif
+            for (; gotEvent; gotEvent = SDL_PollEvent(&event) != 0) {
+                #ifndef __EMSCRIPTEN__
+                    if (event.type == wakeEvent) {
+                        dirty = true;
+                        continue;
+                    }
+                #endif
                 switch (event.type) {
                     /*
                     case SDL_MOUSEBUTTONDOWN:
@@ -292,29 +948,41 @@ class Client {
                     */
                     break;
                     case SDL_WINDOWEVENT:
-                        redraw = true;
+                        dirty = true;
+                        windowStale = true;
                         switch (event.window.event) {
                             case SDL_WINDOWEVENT_RESIZED:
                             case SDL_WINDOWEVENT_SIZE_CHANGED:
-                                /*
-                                //Resize font:
-                                TTF_CloseFont(font);
-                                font = TTF_OpenFont(
-                                        "assets/Hack-Regular.ttf", 
-                                        //height
-                                        event.window.data2 / 64); 
-                                */
+                                //Text picks its size bucket on relayout.
                             break;
                         }
                     break;
+                    case SDL_RENDER_TARGETS_RESET:
+                    case SDL_RENDER_DEVICE_RESET:
+                        onRenderReset();
+                    break;
                     case SDL_QUIT:
                         finished = true;
                     break;
                 }
-                if (redraw) {
-                    draw();
-                }
             }
+
+            const std::uint32_t now {SDL_GetTicks()};
+            const bool frameDue {animating(now) 
+                 && static_cast<std::int32_t>(now - nextFrameAt) >= 0};
+            if (dirty || frameDue) {
+                draw();
+                dirty = false;
+                nextFrameAt = now + frameBudget;
+            }
+            #ifdef __EMSCRIPTEN__
+                //Nothing to show until input or the network wakes us up
+                //again, so stop asking the browser for frames.
+                if (!dirty && !animating(now) && !finished) {
+                    paused = true;
+                    emscripten_pause_main_loop();
+                }
+            #endif
         }
 };
 
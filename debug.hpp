@@ -1,12 +1,429 @@
 #pragma once
 
-#ifdef ENABLE_LOGGING
-    #include <cstdio>
-    namespace Debug {
-        auto& log {std::printf};
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Tracing and metrics cheap enough to leave on in production.
+//
+//A trace event is binary: a timestamp, a format string literal and up to
+//four integer arguments, stored in a ring owned by the calling thread. So
+//recording one never locks, allocates, formats or touches a shared cache
+//line; the ring keeps the most recent events and overwrites the rest.
+//Events below the compile-time level (DEBUG_LEVEL, or TRACE when
+//ENABLE_LOGGING is defined) compile to nothing. Counters and histograms
+//are relaxed atomics. Formatting only happens in dump(), which a Reporter
+//calls from its own thread.
+namespace Debug {
+    enum class Level : std::uint8_t {
+        TRACE,
+        INFO,
+        WARN,
+        ERROR,
+    };
+
+    #if defined(DEBUG_LEVEL)
+        constexpr Level minimumLevel {static_cast<Level>(DEBUG_LEVEL)};
+    #elif defined(ENABLE_LOGGING)
+        constexpr Level minimumLevel {Level::TRACE};
+    #else
+        constexpr Level minimumLevel {Level::INFO};
+    #endif
+
+    //Monotonic nanoseconds.
+    inline std::uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    inline std::uint64_t microsSince(const std::uint64_t start) {
+        return (now() - start) / 1000;
+    }
+
+    struct Event {
+        std::uint64_t time {0};
+        //Arguments are formatted with %lld.
+        const char* format {nullptr};
+        std::array<std::int64_t, 4> arguments {};
+        Level level {Level::TRACE};
+    };
+
+    //Written by one thread, read by dump(). The reader copies what it
+    //wants and then discards anything the writer may have lapped meanwhile.
+    class TraceRing {
+        private:
+            static constexpr std::size_t capacity {1024};
+
+            std::array<Event, capacity> events {};
+            std::atomic<std::uint64_t> head {0};
+
+        public:
+            const unsigned thread;
+
+            explicit TraceRing(const unsigned thread) : thread {thread} {}
+
+            void push(const Event& event) {
+                const std::uint64_t position {
+                        head.load(std::memory_order_relaxed)};
+                events[position & (capacity - 1)] = event;
+                head.store(position + 1, std::memory_order_release);
+            }
+
+            //Appends up to count of the most recent events to out.
+            void copyRecent(std::vector<Event>& out, const std::size_t count) const {
+                const std::uint64_t end {head.load(std::memory_order_acquire)};
+                const std::uint64_t begin {
+                        end - std::min<std::uint64_t>({end, count, capacity})};
+                const std::size_t start {out.size()};
+                for (std::uint64_t i {begin}; i < end; ++i) {
+                    out.push_back(events[i & (capacity - 1)]);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                const std::uint64_t lapped {head.load(std::memory_order_relaxed)};
+                //Slots up to lapped - capacity may have been rewritten; that
+                //one may still be being written by the push of lapped.
+                const std::uint64_t firstIntact {
+                        lapped >= capacity ? lapped - capacity + 1 : 0};
+                if (firstIntact > begin) {
+                    const std::size_t torn {static_cast<std::size_t>(
+                            std::min(firstIntact, end) - begin)};
+                    out.erase(out.begin() + start, out.begin() + start + torn);
+                }
+            }
+    };
+
+    class Counter;
+    class Histogram;
+
+    //Everything dump() reports. Only touched when a thread traces for the
+    //first time and when metrics are created or destroyed.
+    class Registry {
+        private:
+            std::mutex mutex {};
+            //Shared so a ring outlives its thread until the next dump, which
+            //reports its last events and then drops it.
+            std::vector<std::shared_ptr<TraceRing>> rings {};
+            unsigned nextThread {0};
+            std::vector<const Counter*> counters {};
+            std::vector<const Histogram*> histograms {};
+
+        public:
+            std::shared_ptr<TraceRing> addRing() {
+                const std::lock_guard lock {mutex};
+                rings.push_back(std::make_shared<TraceRing>(nextThread++));
+                return rings.back();
+            }
+            template <typename Metric>
+            void add(std::vector<const Metric*>& metrics, const Metric* metric) {
+                const std::lock_guard lock {mutex};
+                metrics.push_back(metric);
+            }
+            template <typename Metric>
+            void remove(std::vector<const Metric*>& metrics, const Metric* metric) {
+                const std::lock_guard lock {mutex};
+                std::erase(metrics, metric);
+            }
+            void add(const Counter* counter) {
+                add(counters, counter);
+            }
+            void remove(const Counter* counter) {
+                remove(counters, counter);
+            }
+            void add(const Histogram* histogram) {
+                add(histograms, histogram);
+            }
+            void remove(const Histogram* histogram) {
+                remove(histograms, histogram);
+            }
+
+            //Calls visit with the lists while holding the lock, then drops
+            //the rings only the registry still holds: their threads have
+            //exited, and cannot take them back.
+            template <typename Visit>
+            void visit(Visit&& visit) {
+                const std::lock_guard lock {mutex};
+                visit(rings, counters, histograms);
+                std::erase_if(rings, [](const std::shared_ptr<TraceRing>& ring) {
+                    return ring.use_count() == 1;
+                });
+            }
+    };
+
+    inline Registry& registry() {
+        static Registry instance {};
+        return instance;
+    }
+
+    inline TraceRing& localRing() {
+        thread_local const std::shared_ptr<TraceRing> ring {
+                registry().addRing()};
+        return *ring;
+    }
+
+    template <Level level, typename... Arguments>
+    inline void event(const char* format, const Arguments... arguments) {
+        static_assert(sizeof...(Arguments) <= 4);
+        if constexpr (level >= minimumLevel) {
+            localRing().push({
+                    .time = now(),
+                    .format = format,
+                    .arguments = {static_cast<std::int64_t>(arguments)...},
+                    .level = level});
+        }
     }
-#else
-    namespace Debug {
-        inline void log(...) {}
+    //format must be a string literal; it is read when the event is dumped.
+    template <typename... Arguments>
+    inline void trace(const char* format, const Arguments... arguments) {
+        event<Level::TRACE>(format, arguments...);
     }
-#endif
+    template <typename... Arguments>
+    inline void info(const char* format, const Arguments... arguments) {
+        event<Level::INFO>(format, arguments...);
+    }
+    template <typename... Arguments>
+    inline void warn(const char* format, const Arguments... arguments) {
+        event<Level::WARN>(format, arguments...);
+    }
+    template <typename... Arguments>
+    inline void error(const char* format, const Arguments... arguments) {
+        event<Level::ERROR>(format, arguments...);
+    }
+
+    //A named total; add a negative amount to use it as a gauge.
+    class Counter {
+        private:
+            alignas(64) std::atomic<std::int64_t> value {0};
+
+        public:
+            const char* const name;
+
+            explicit Counter(const char* name) : name {name} {
+                registry().add(this);
+            }
+            Counter(const Counter&) = delete;
+            Counter& operator=(const Counter&) = delete;
+            ~Counter() {
+                registry().remove(this);
+            }
+
+            void add(const std::int64_t amount = 1) {
+                value.fetch_add(amount, std::memory_order_relaxed);
+            }
+            std::int64_t get() const {
+                return value.load(std::memory_order_relaxed);
+            }
+    };
+
+    //Log-linear buckets over microseconds: 32 per power of two, so every
+    //percentile is within about 3% of the true value. Unnamed histograms
+    //are not registered and so are left out of dump().
+    class Histogram {
+        private:
+            static constexpr unsigned subBits {5};
+            static constexpr unsigned subCount {1 << subBits};
+            static constexpr unsigned bucketCount {(40 - subBits) * subCount};
+
+            std::unique_ptr<std::atomic<std::uint64_t>[]> buckets {
+                    std::make_unique<std::atomic<std::uint64_t>[]>(bucketCount)};
+
+            static unsigned bucketOf(const std::uint64_t value) {
+                if (value < subCount) {
+                    return static_cast<unsigned>(value);
+                }
+                const unsigned shift {static_cast<unsigned>(
+                        std::bit_width(value)) - subBits - 1};
+                return std::min(
+                        (shift + 1) * subCount
+                      + static_cast<unsigned>((value >> shift) - subCount),
+                        bucketCount - 1);
+            }
+            //Upper bound of the values in a bucket.
+            static std::uint64_t valueOf(const unsigned bucket) {
+                if (bucket < subCount) {
+                    return bucket;
+                }
+                const unsigned shift {bucket / subCount - 1};
+                return ((std::uint64_t{subCount} + bucket % subCount + 1)
+                        << shift) - 1;
+            }
+
+        public:
+            const char* const name;
+
+            explicit Histogram(const char* name = nullptr) : name {name} {
+                if (name != nullptr) {
+                    registry().add(this);
+                }
+            }
+            Histogram(const Histogram&) = delete;
+            Histogram& operator=(const Histogram&) = delete;
+            ~Histogram() {
+                if (name != nullptr) {
+                    registry().remove(this);
+                }
+            }
+
+            void record(const std::uint64_t micros) {
+                buckets[bucketOf(micros)].fetch_add(
+                        1, std::memory_order_relaxed);
+            }
+
+            std::uint64_t count() const {
+                std::uint64_t total {0};
+                for (unsigned bucket {0}; bucket < bucketCount; ++bucket) {
+                    total += buckets[bucket].load(std::memory_order_relaxed);
+                }
+                return total;
+            }
+            //quantile in [0, 1]; 0 if nothing was recorded.
+            std::uint64_t percentile(const double quantile) const {
+                const std::uint64_t total {count()};
+                if (total == 0) {
+                    return 0;
+                }
+                const auto rank {static_cast<std::uint64_t>(
+                        quantile * (total - 1)) + 1};
+                std::uint64_t seen {0};
+                for (unsigned bucket {0}; bucket < bucketCount; ++bucket) {
+                    seen += buckets[bucket].load(std::memory_order_relaxed);
+                    if (seen >= rank) {
+                        return valueOf(bucket);
+                    }
+                }
+                return valueOf(bucketCount - 1);
+            }
+    };
+
+    //Writes every counter, histogram and the most recent trace events to
+    //path as text, replacing it atomically. Returns false on I/O errors.
+    inline bool dump(const std::filesystem::path& path) {
+        constexpr std::size_t eventsPerThread {64};
+        constexpr std::array<const char*, 4> levelNames {
+                "TRACE", "INFO", "WARN", "ERROR"};
+        const std::filesystem::path temporary {path.string() + ".tmp"};
+        std::FILE* file {std::fopen(temporary.c_str(), "w")};
+        if (file == nullptr) {
+            return false;
+        }
+        const std::uint64_t dumpedAt {now()};
+        std::vector<std::pair<unsigned, Event>> events {};
+        registry().visit([&](
+                const std::vector<std::shared_ptr<TraceRing>>& rings,
+                const std::vector<const Counter*>& counters,
+                const std::vector<const Histogram*>& histograms) {
+            std::fprintf(file, "counters\n");
+            for (const Counter* counter : counters) {
+                std::fprintf(file, "    %-24s %lld\n", counter->name,
+                        static_cast<long long>(counter->get()));
+            }
+            std::fprintf(file, "\nhistograms (us) %22s %9s %9s %9s\n",
+                    "count", "p50", "p99", "p999");
+            for (const Histogram* histogram : histograms) {
+                std::fprintf(file, "    %-24s %9llu %9llu %9llu %9llu\n",
+                        histogram->name,
+                        static_cast<unsigned long long>(histogram->count()),
+                        static_cast<unsigned long long>(
+                                histogram->percentile(0.5)),
+                        static_cast<unsigned long long>(
+                                histogram->percentile(0.99)),
+                        static_cast<unsigned long long>(
+                                histogram->percentile(0.999)));
+            }
+            std::vector<Event> recent {};
+            for (const auto& ring : rings) {
+                recent.clear();
+                ring->copyRecent(recent, eventsPerThread);
+                for (const Event& event : recent) {
+                    events.emplace_back(ring->thread, event);
+                }
+            }
+        });
+
+        std::sort(events.begin(), events.end(), [](
+                const auto& left, const auto& right) {
+            return left.second.time < right.second.time;
+        });
+        std::fprintf(file, "\nrecent events (ms ago, thread, level)\n");
+        std::array<char, 256> message {};
+        for (const auto& [thread, event] : events) {
+            std::snprintf(message.data(), message.size(), event.format,
+                    static_cast<long long>(event.arguments[0]),
+                    static_cast<long long>(event.arguments[1]),
+                    static_cast<long long>(event.arguments[2]),
+                    static_cast<long long>(event.arguments[3]));
+            std::fprintf(file, "    %10.3f %3u %-5s %s\n",
+                    (dumpedAt - event.time) / 1e6,
+                    thread,
+                    levelNames[static_cast<std::size_t>(event.level)],
+                    message.data());
+        }
+        if (std::fclose(file) != 0) {
+            return false;
+        }
+        std::error_code error {};
+        std::filesystem::rename(temporary, path, error);
+        return !error;
+    }
+
+    //Calls dump() every interval from a thread of its own, and once more
+    //when stopped.
+    class Reporter {
+        private:
+            const std::filesystem::path path;
+            const std::chrono::milliseconds interval;
+            std::mutex mutex {};
+            std::condition_variable wake {};
+            bool running {true};
+            std::thread thread;
+
+            //Sleeps until the next dump is due or stop() is called.
+            void loop() {
+                auto next {std::chrono::steady_clock::now() + interval};
+                std::unique_lock lock {mutex};
+                while (running) {
+                    if (!wake.wait_until(lock, next, [this] { return !running; })) {
+                        lock.unlock();
+                        dump(path);
+                        lock.lock();
+                        next += interval;
+                    }
+                }
+                lock.unlock();
+                dump(path);
+            }
+
+        public:
+            Reporter(std::filesystem::path path,
+                    const std::chrono::milliseconds interval)
+                  : path {std::move(path)},
+                    interval {interval},
+                    thread {&Reporter::loop, this} {}
+            Reporter(const Reporter&) = delete;
+            Reporter& operator=(const Reporter&) = delete;
+            ~Reporter() {
+                stop();
+            }
+
+            void stop() {
+                {
+                    const std::lock_guard lock {mutex};
+                    running = false;
+                }
+                wake.notify_one();
+                if (thread.joinable()) {
+                    thread.join();
+                }
+            }
+    };
+}
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+//Authoritative Liar's Dice rules. A table's whole state is one small
+//trivially copyable struct; hands are per-face counts packed into an
+//integer, so counting dice across the table is a handful of additions.
+namespace Game {
+    constexpr std::size_t maxSeats {6};
+    constexpr unsigned faceCount {6};
+    constexpr unsigned startingDice {5};
+    constexpr unsigned maxDice {maxSeats * startingDice};
+
+    //Per-face counts, 5 bits per face, face 1 in the lowest bits. A lane can
+    //hold the sum of every hand at a full table (30), so hands are added
+    //lane-wise with plain integer addition.
+    using Hand = std::uint32_t;
+    constexpr unsigned laneBits {5};
+    constexpr Hand laneMask {(1u << laneBits) - 1};
+
+    constexpr unsigned faceCountOf(const Hand hand, const unsigned face) {
+        return (hand >> (laneBits * (face - 1))) & laneMask;
+    }
+
+    namespace Rules {
+        constexpr std::uint8_t STANDARD {0};
+        //Ones count towards every other face.
+        constexpr std::uint8_t WILD_ONES {1 << 0};
+    }
+
+    //How many dice of face the bid on it is counting, given every hand.
+    constexpr unsigned matching(
+            const Hand total,
+            const unsigned face,
+            const std::uint8_t rules) {
+        const bool wild {(rules & Rules::WILD_ONES) != 0 && face != 1};
+        return faceCountOf(total, face) + wild * faceCountOf(total, 1);
+    }
+
+    //Bids are totally ordered by count, then face.
+    constexpr unsigned bidRank(const unsigned count, const unsigned face) {
+        return count * faceCount + (face - 1);
+    }
+
+    enum class Phase : std::uint8_t {
+        SEATING,
+        BIDDING,
+        ROUND_OVER,
+        GAME_OVER,
+    };
+
+    enum class Result : std::uint8_t {
+        OK,
+        NOT_PLAYING,
+        NOT_YOUR_TURN,
+        ILLEGAL_BID,
+        ILLEGAL_CHALLENGE,
+        TABLE_FULL,
+    };
+
+    struct ChallengeOutcome {
+        Result result {Result::OK};
+        std::uint8_t challenger {0};
+        std::uint8_t bidder {0};
+        std::uint8_t actual {0};
+        std::uint8_t loser {0};
+    };
+
+    class Table {
+        private:
+            std::array<Hand, maxSeats> hands {};
+            std::uint64_t rng {0};
+            //3 bits of dice count per seat.
+            std::uint32_t diceCounts {0};
+            std::uint8_t seatedMask {0};
+            std::uint8_t seatLimit {maxSeats};
+            std::uint8_t rules {Rules::STANDARD};
+            Phase phase {Phase::SEATING};
+            std::uint8_t turn {0};
+            std::uint8_t bidder {0};
+            std::uint8_t bidCount {0};
+            std::uint8_t bidFace {0};
+            std::uint16_t round {0};
+
+            std::uint64_t nextRandom() {
+                //xorshift64*
+                rng ^= rng >> 12;
+                rng ^= rng << 25;
+                rng ^= rng >> 27;
+                return rng * 0x2545F4914F6CDD1Dull;
+            }
+            unsigned rollFace() {
+                //Maps the top 32 bits onto [0, 6) without division.
+                return static_cast<unsigned>(
+                        ((nextRandom() >> 32) * faceCount) >> 32);
+            }
+
+            void setDice(const unsigned seat, const unsigned count) {
+                diceCounts &= ~(std::uint32_t{7} << (3 * seat));
+                diceCounts |= std::uint32_t{count} << (3 * seat);
+            }
+
+            //The first seat after seat (wrapping) in mask.
+            static std::uint8_t nextIn(
+                    const std::uint8_t mask, const unsigned seat) {
+                const unsigned rotated {
+                        (static_cast<unsigned>(mask) | mask << maxSeats)
+                     >> (seat + 1)};
+                return static_cast<std::uint8_t>(
+                        (seat + 1 + std::countr_zero(rotated)) % maxSeats);
+            }
+
+        public:
+            Table() = default;
+            Table(const std::uint64_t seed,
+                    const std::uint8_t seatLimit,
+                    const std::uint8_t rules)
+                  : rng {seed | 1},
+                    seatLimit {static_cast<std::uint8_t>(
+                            seatLimit < 2 || seatLimit > maxSeats
+                          ? maxSeats : seatLimit)},
+                    rules {rules} {}
+
+            Phase currentPhase() const {
+                return phase;
+            }
+            std::uint8_t currentTurn() const {
+                return turn;
+            }
+            std::uint8_t currentRules() const {
+                return rules;
+            }
+            std::uint16_t currentRound() const {
+                return round;
+            }
+            unsigned currentBidCount() const {
+                return bidCount;
+            }
+            unsigned currentBidFace() const {
+                return bidFace;
+            }
+            std::uint8_t currentBidder() const {
+                return bidder;
+            }
+            unsigned dice(const unsigned seat) const {
+                return (diceCounts >> (3 * seat)) & 7;
+            }
+            std::uint32_t packedDiceCounts() const {
+                return diceCounts;
+            }
+            unsigned totalDice() const {
+                unsigned total {0};
+                for (unsigned seat {0}; seat < maxSeats; ++seat) {
+                    total += dice(seat);
+                }
+                return total;
+            }
+            Hand hand(const unsigned seat) const {
+                return hands[seat];
+            }
+            //Seats still holding dice, one bit each.
+            std::uint8_t activeMask() const {
+                std::uint8_t mask {0};
+                for (unsigned seat {0}; seat < maxSeats; ++seat) {
+                    mask |= (dice(seat) != 0) << seat;
+                }
+                return mask;
+            }
+            //Seats taken, one bit each.
+            std::uint8_t occupiedMask() const {
+                return seatedMask;
+            }
+            bool seated(const unsigned seat) const {
+                return (seatedMask >> seat) & 1;
+            }
+            unsigned seatedCount() const {
+                return std::popcount(seatedMask);
+            }
+            unsigned seatCapacity() const {
+                return seatLimit;
+            }
+            //The only seat left with dice, once the game is over.
+            std::uint8_t winner() const {
+                return static_cast<std::uint8_t>(
+                        std::countr_zero(static_cast<unsigned>(activeMask())));
+            }
+
+            //Takes the lowest free seat; returns it, or maxSeats if none.
+            unsigned seat() {
+                const unsigned free {static_cast<unsigned>(
+                        std::countr_one(static_cast<unsigned>(seatedMask)))};
+                if (phase != Phase::SEATING || free >= seatLimit) {
+                    return maxSeats;
+                }
+                seatedMask |= 1 << free;
+                return free;
+            }
+            //A player leaving mid-game forfeits their dice, and withdraws
+            //the standing bid if it is theirs: the next seat opens afresh.
+            void unseat(const unsigned seat) {
+                seatedMask &= ~(1 << seat);
+                if (phase == Phase::SEATING || dice(seat) == 0) {
+                    return;
+                }
+                setDice(seat, 0);
+                hands[seat] = 0;
+                if (phase == Phase::BIDDING && seat == bidder) {
+                    bidCount = 0;
+                    bidFace = 0;
+                }
+                if (std::popcount(activeMask()) < 2) {
+                    phase = Phase::GAME_OVER;
+                }
+                else if (turn == seat) {
+                    turn = nextIn(activeMask(), seat);
+                }
+            }
+
+            Result start() {
+                if (phase != Phase::SEATING || std::popcount(seatedMask) < 2) {
+                    return Result::NOT_PLAYING;
+                }
+                for (unsigned seat {0}; seat < maxSeats; ++seat) {
+                    setDice(seat, seated(seat) * startingDice);
+                }
+                turn = static_cast<std::uint8_t>(
+                        std::countr_zero(static_cast<unsigned>(seatedMask)));
+                startRound();
+                return Result::OK;
+            }
+
+            //Rerolls every hand. The turn is left with whoever should open.
+            void startRound() {
+                for (unsigned seat {0}; seat < maxSeats; ++seat) {
+                    Hand rolled {0};
+                    for (unsigned die {dice(seat)}; die > 0; --die) {
+                        rolled += Hand{1} << (laneBits * rollFace());
+                    }
+                    hands[seat] = rolled;
+                }
+                bidCount = 0;
+                bidFace = 0;
+                ++round;
+                phase = Phase::BIDDING;
+            }
+
+            bool legalBid(const unsigned count, const unsigned face) const {
+                return (face >= 1) & (face <= faceCount)
+                     & (count >= 1) & (count <= totalDice())
+                     & ((bidRank(count, face) > bidRank(bidCount, bidFace))
+                      | (bidCount == 0));
+            }
+
+            Result bid(
+                    const unsigned seat,
+                    const unsigned count,
+                    const unsigned face) {
+                if (phase != Phase::BIDDING) {
+                    return Result::NOT_PLAYING;
+                }
+                if (seat != turn) {
+                    return Result::NOT_YOUR_TURN;
+                }
+                if (!legalBid(count, face)) {
+                    return Result::ILLEGAL_BID;
+                }
+                bidCount = static_cast<std::uint8_t>(count);
+                bidFace = static_cast<std::uint8_t>(face);
+                bidder = static_cast<std::uint8_t>(seat);
+                turn = nextIn(activeMask(), seat);
+                return Result::OK;
+            }
+
+            //Resolves the current bid. Hands stay as they were so they can be
+            //revealed; startRound() rolls the next round unless the game is
+            //over.
+            ChallengeOutcome challenge(const unsigned seat) {
+                if (phase != Phase::BIDDING) {
+                    return {.result = Result::NOT_PLAYING};
+                }
+                if (seat != turn) {
+                    return {.result = Result::NOT_YOUR_TURN};
+                }
+                //A bidder out of dice would wrap their 3-bit count.
+                if (bidCount == 0 || dice(bidder) == 0) {
+                    return {.result = Result::ILLEGAL_CHALLENGE};
+                }
+                Hand total {0};
+                for (const Hand hand : hands) {
+                    total += hand;
+                }
+                const unsigned actual {matching(total, bidFace, rules)};
+                const unsigned loser {actual >= bidCount ? seat : bidder};
+                setDice(loser, dice(loser) - 1);
+                const std::uint8_t active {activeMask()};
+                //The loser opens the next round, or the seat after them if
+                //they are out.
+                turn = static_cast<std::uint8_t>(dice(loser) != 0
+                      ? loser : nextIn(active, loser));
+                phase = std::popcount(active) < 2
+                      ? Phase::GAME_OVER : Phase::ROUND_OVER;
+                return {
+                        .challenger = static_cast<std::uint8_t>(seat),
+                        .bidder = bidder,
+                        .actual = static_cast<std::uint8_t>(actual),
+                        .loser = static_cast<std::uint8_t>(loser)};
+            }
+    };
+}
@@ -0,0 +1,579 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <variant>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/beast.hpp>
+#include <boost/beast/ssl.hpp>
+#include "debug.hpp"
+#include "game.hpp"
+#include "protocol.hpp"
+
+namespace beast = boost::beast;
+namespace asio = boost::asio;
+
+//Headless load generator. Opens many websocket connections to a running
+//server, has each one play heads-up games against a server bot with random
+//legal moves, and reports throughput and request latency once a second and
+//at the end.
+//
+//    loadgen [--host HOST] [--port PORT] [--connections N] [--seconds N]
+//            [--threads N] [--server-pid PID] [--seed N] [--queue]
+//            [--plaintext]
+//
+//Latency is measured per request, from the write being queued to the
+//message that answers it (WELCOME, TABLE_JOINED, PLAYER_JOINED,
+//ROUND_STARTED, BID_MADE or CHALLENGE_RESULT). Requests answered with an
+//ERROR are counted as rejected and left out of the latency and message
+//rates. With --server-pid the server's resident set is sampled from /proc
+//too.
+//
+//With --plaintext it speaks ws:// to a server run with --plaintext, for
+//comparing against TLS.
+//
+//With --queue, connections are matched against each other through the
+//server's heads-up queue instead, and the TABLE_JOINED latency is the
+//queue-to-seat time.
+class LoadGenerator {
+    private:
+        using Clock = std::chrono::steady_clock;
+        using TlsWebsocketStream = beast::websocket::stream<
+                beast::ssl_stream<beast::tcp_stream>>;
+        using PlainWebsocketStream = beast::websocket::stream<beast::tcp_stream>;
+
+        struct Session {
+            std::variant<TlsWebsocketStream, PlainWebsocketStream> socket;
+            beast::flat_buffer message {};
+            std::vector<std::uint8_t> outbound {};
+            std::vector<std::uint8_t> writing {};
+            bool writingInFlight {false};
+            std::mt19937 random;
+
+            //Answering this type ends the request in flight, if any.
+            std::optional<Protocol::MessageType> awaiting {};
+            Clock::time_point sentAt {};
+
+            std::uint8_t seat {0};
+            std::uint8_t turn {0};
+            Protocol::PackedDiceCounts diceCounts {0};
+            std::uint8_t bidCount {0};
+            std::uint8_t bidFace {0};
+
+            Session(asio::io_context& ioContext,
+                    asio::ssl::context& sslContext,
+                    const bool plaintext,
+                    const std::uint32_t seed)
+                  : socket {plaintext
+                          ? decltype(socket){
+                                    std::in_place_type<PlainWebsocketStream>,
+                                    asio::make_strand(ioContext)}
+                          : decltype(socket){
+                                    std::in_place_type<TlsWebsocketStream>,
+                                    asio::make_strand(ioContext),
+                                    sslContext}},
+                    random {seed} {}
+        };
+
+        template <typename Visit>
+        static decltype(auto) withSocket(Session& session, Visit&& visit) {
+            return std::visit(std::forward<Visit>(visit), session.socket);
+        }
+
+        const std::string host;
+        const std::string port;
+        const bool matchmaking;
+        const bool plaintext;
+        asio::io_context ioContext {};
+        asio::ssl::context sslContext {asio::ssl::context::tls_client};
+        asio::ip::tcp::resolver::results_type endpoints {};
+        std::vector<std::unique_ptr<Session>> sessions {};
+
+        Debug::Histogram latency {};
+        std::atomic<std::uint64_t> handshakes {0};
+        std::atomic<std::uint64_t> failures {0};
+        std::atomic<std::uint64_t> messagesSent {0};
+        std::atomic<std::uint64_t> messagesReceived {0};
+        std::atomic<std::uint64_t> rejected {0};
+        std::atomic<std::uint64_t> gamesFinished {0};
+        std::atomic<std::uint64_t> lastHandshakeMicros {0};
+        Clock::time_point startedAt {};
+
+        std::uint64_t elapsedMicros() const {
+            return std::chrono::duration_cast<std::chrono::microseconds>(
+                    Clock::now() - startedAt).count();
+        }
+
+        template <typename Message>
+        void sessionSend(
+                Session& session,
+                const Message& message,
+                const Protocol::MessageType answer) {
+            Protocol::encode(session.outbound, message);
+            session.awaiting = answer;
+            session.sentAt = Clock::now();
+            messagesSent.fetch_add(1, std::memory_order_relaxed);
+            sessionFlush(session);
+        }
+        void sessionFlush(Session& session) {
+            if (session.writingInFlight || session.outbound.empty()) {
+                return;
+            }
+            std::swap(session.outbound, session.writing);
+            session.writingInFlight = true;
+            withSocket(session, [&](auto& socket) {
+                socket.async_write(
+                        asio::buffer(session.writing),
+                        std::bind(
+                                &LoadGenerator::sessionOnWrite,
+                                this,
+                                std::ref(session),
+                                std::placeholders::_1));
+            });
+        }
+        void sessionOnWrite(
+                Session& session,
+                const boost::system::error_code& error) {
+            session.writingInFlight = false;
+            session.writing.clear();
+            if (error) {
+                return;
+            }
+            sessionFlush(session);
+        }
+
+        void sessionConnect(Session& session) {
+            withSocket(session, [&](auto& socket) {
+                beast::get_lowest_layer(socket).async_connect(
+                        endpoints,
+                        std::bind(
+                                &LoadGenerator::sessionOnConnect,
+                                this,
+                                std::ref(session),
+                                std::placeholders::_1));
+            });
+        }
+        void sessionOnConnect(
+                Session& session,
+                const boost::system::error_code& error) {
+            if (error) {
+                failures.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            withSocket(session, [](auto& socket) {
+                beast::get_lowest_layer(socket).socket().set_option(
+                        asio::ip::tcp::no_delay(true));
+            });
+            auto* socket {std::get_if<TlsWebsocketStream>(&session.socket)};
+            if (socket == nullptr) {
+                sessionOnTlsHandshake(session, {});
+                return;
+            }
+            socket->next_layer().async_handshake(
+                    asio::ssl::stream_base::client,
+                    std::bind(
+                            &LoadGenerator::sessionOnTlsHandshake,
+                            this,
+                            std::ref(session),
+                            std::placeholders::_1));
+        }
+        void sessionOnTlsHandshake(
+                Session& session,
+                const boost::system::error_code& error) {
+            if (error) {
+                failures.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            withSocket(session, [&](auto& socket) {
+                socket.async_handshake(
+                        host,
+                        "/",
+                        std::bind(
+                                &LoadGenerator::sessionOnHandshake,
+                                this,
+                                std::ref(session),
+                                std::placeholders::_1));
+            });
+        }
+        void sessionOnHandshake(
+                Session& session,
+                const boost::system::error_code& error) {
+            if (error) {
+                failures.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            handshakes.fetch_add(1, std::memory_order_relaxed);
+            lastHandshakeMicros.store(
+                    elapsedMicros(), std::memory_order_relaxed);
+            withSocket(session, [](auto& socket) {
+                socket.binary(true);
+            });
+            sessionRead(session);
+            sessionSend(
+                    session,
+                    Protocol::Hello{},
+                    Protocol::MessageType::WELCOME);
+        }
+
+        void sessionRead(Session& session) {
+            withSocket(session, [&](auto& socket) {
+                socket.async_read(
+                        session.message,
+                        std::bind(
+                                &LoadGenerator::sessionOnRead,
+                                this,
+                                std::ref(session),
+                                std::placeholders::_1));
+            });
+        }
+        void sessionOnRead(
+                Session& session,
+                const boost::system::error_code& error) {
+            if (error) {
+                if (error != asio::error::operation_aborted) {
+                    failures.fetch_add(1, std::memory_order_relaxed);
+                }
+                return;
+            }
+            const Protocol::Frame frame {
+                    session.message.cdata().data(),
+                    session.message.size()};
+            for (const Protocol::View& view : frame) {
+                if (view.type == Protocol::MessageType::ERROR) {
+                    rejected.fetch_add(1, std::memory_order_relaxed);
+                    session.awaiting.reset();
+                    continue;
+                }
+                messagesReceived.fetch_add(1, std::memory_order_relaxed);
+                if (session.awaiting && view.type == *session.awaiting) {
+                    session.awaiting.reset();
+                    latency.record(std::chrono::duration_cast<
+                            std::chrono::microseconds>(
+                                    Clock::now() - session.sentAt).count());
+                }
+                sessionOnMessage(session, view);
+            }
+            session.message.consume(session.message.size());
+            sessionRead(session);
+        }
+
+        //A table of its own with a bot, or a place in the queue.
+        void sessionFindTable(Session& session) {
+            if (matchmaking) {
+                sessionSend(
+                        session,
+                        Protocol::Queue{.seatCount = 2},
+                        Protocol::MessageType::TABLE_JOINED);
+            }
+            else {
+                sessionSend(
+                        session,
+                        Protocol::CreateTable{.seatCount = 2},
+                        Protocol::MessageType::TABLE_JOINED);
+            }
+        }
+
+        //Scripted lobby, random play: make a two-seat table, add a bot,
+        //start, and keep doing that after every game. Matched tables start
+        //by themselves. Only a join at another seat (the bot) is a cue to
+        //start; the table's own snapshot already covers the joiner.
+        void sessionOnMessage(Session& session, const Protocol::View& view) {
+            switch (view.type) {
+                case Protocol::MessageType::WELCOME:
+                    sessionFindTable(session);
+                break;
+                case Protocol::MessageType::TABLE_JOINED:
+                    if (const auto joined {
+                            Protocol::decode<Protocol::TableJoined>(view)}) {
+                        session.seat = joined->seat;
+                        if (matchmaking) {
+                            break;
+                        }
+                        sessionSend(
+                                session,
+                                Protocol::AddBot{},
+                                Protocol::MessageType::PLAYER_JOINED);
+                    }
+                break;
+                case Protocol::MessageType::PLAYER_JOINED:
+                    if (const auto joined {
+                            Protocol::decode<Protocol::PlayerJoined>(view)}) {
+                        if (matchmaking || joined->seat == session.seat) {
+                            break;
+                        }
+                        sessionSend(
+                                session,
+                                Protocol::StartGame{},
+                                Protocol::MessageType::ROUND_STARTED);
+                    }
+                break;
+                case Protocol::MessageType::ROUND_STARTED:
+                    if (const auto round {
+                            Protocol::decode<Protocol::RoundStarted>(view)}) {
+                        session.turn = round->turn;
+                        session.diceCounts = round->diceCounts;
+                        session.bidCount = 0;
+                        session.bidFace = 0;
+                        sessionPlay(session);
+                    }
+                break;
+                case Protocol::MessageType::BID_MADE:
+                    if (const auto bid {
+                            Protocol::decode<Protocol::BidMade>(view)}) {
+                        session.bidCount = bid->count;
+                        session.bidFace = bid->face;
+                        //Heads-up, so the turn always passes to the other.
+                        session.turn = bid->seat == session.seat
+                              ? static_cast<std::uint8_t>(1 - session.seat)
+                              : session.seat;
+                        sessionPlay(session);
+                    }
+                break;
+                case Protocol::MessageType::GAME_OVER:
+                    gamesFinished.fetch_add(1, std::memory_order_relaxed);
+                    Protocol::encode(session.outbound, Protocol::LeaveTable{});
+                    messagesSent.fetch_add(1, std::memory_order_relaxed);
+                    sessionFindTable(session);
+                break;
+                default:
+                break;
+            }
+        }
+
+        //Challenges a third of the time, otherwise raises by one or two
+        //steps; always legal.
+        void sessionPlay(Session& session) {
+            if (session.turn != session.seat) {
+                return;
+            }
+            unsigned totalDice {0};
+            for (unsigned seat {0}; seat < Game::maxSeats; ++seat) {
+                totalDice += (session.diceCounts >> (3 * seat)) & 7;
+            }
+            const unsigned rank {session.bidCount == 0
+                  ? Game::bidRank(1, 1) - 1
+                  : Game::bidRank(session.bidCount, session.bidFace)};
+            const unsigned next {rank + 1
+                  + static_cast<unsigned>(session.random() % 2)};
+            const unsigned count {next / Game::faceCount};
+            const bool canRaise {count <= totalDice};
+            if (session.bidCount != 0
+             && (!canRaise || session.random() % 3 == 0)) {
+                sessionSend(
+                        session,
+                        Protocol::Challenge{},
+                        Protocol::MessageType::CHALLENGE_RESULT);
+                return;
+            }
+            sessionSend(
+                    session,
+                    Protocol::Bid{
+                            .count = static_cast<std::uint8_t>(count),
+                            .face = static_cast<std::uint8_t>(
+                                    next % Game::faceCount + 1)},
+                    Protocol::MessageType::BID_MADE);
+        }
+
+        static std::uint64_t residentKiB(const long pid, const char* field) {
+            const std::string path {"/proc/" + std::to_string(pid) + "/status"};
+            std::FILE* file {std::fopen(path.c_str(), "r")};
+            if (file == nullptr) {
+                return 0;
+            }
+            std::array<char, 256> line {};
+            std::uint64_t value {0};
+            const std::size_t fieldLength {std::strlen(field)};
+            while (std::fgets(line.data(), line.size(), file) != nullptr) {
+                if (std::strncmp(line.data(), field, fieldLength) == 0) {
+                    value = std::strtoull(
+                            line.data() + fieldLength, nullptr, 10);
+                    break;
+                }
+            }
+            std::fclose(file);
+            return value;
+        }
+
+    public:
+        LoadGenerator(
+                std::string host,
+                std::string port,
+                const bool matchmaking,
+                const bool plaintext)
+              : host {std::move(host)},
+                port {std::move(port)},
+                matchmaking {matchmaking},
+                plaintext {plaintext} {
+            //The server's certificate is self-signed in development.
+            sslContext.set_verify_mode(asio::ssl::verify_none);
+        }
+
+        int run(
+                const std::size_t connectionCount,
+                const unsigned seconds,
+                const unsigned threadCount,
+                const long serverPid,
+                const std::uint32_t seed) {
+            boost::system::error_code error {};
+            endpoints = asio::ip::tcp::resolver{ioContext}.resolve(
+                    host, port, error);
+            if (error) {
+                std::fprintf(stderr, "could not resolve %s:%s\n",
+                        host.c_str(), port.c_str());
+                return 1;
+            }
+
+            startedAt = Clock::now();
+            sessions.reserve(connectionCount);
+            for (std::size_t i {0}; i < connectionCount; ++i) {
+                sessions.push_back(std::make_unique<Session>(
+                        ioContext,
+                        sslContext,
+                        plaintext,
+                        static_cast<std::uint32_t>(seed + i)));
+                sessionConnect(*sessions.back());
+            }
+            auto work {asio::make_work_guard(ioContext)};
+            std::vector<std::thread> workers;
+            for (unsigned thread {0}; thread < threadCount; ++thread) {
+                workers.emplace_back([this] {
+                    ioContext.run();
+                });
+            }
+
+            std::uint64_t lastMessages {0};
+            for (unsigned second {1}; second <= seconds; ++second) {
+                std::this_thread::sleep_until(
+                        startedAt + std::chrono::seconds(second));
+                const std::uint64_t messages {
+                        messagesSent.load() + messagesReceived.load()};
+                std::printf(
+                        "%3us connected %llu failed %llu msg/s %llu "
+                        "rejected %llu p50 %lluus p99 %lluus",
+                        second,
+                        static_cast<unsigned long long>(handshakes.load()),
+                        static_cast<unsigned long long>(failures.load()),
+                        static_cast<unsigned long long>(messages - lastMessages),
+                        static_cast<unsigned long long>(rejected.load()),
+                        static_cast<unsigned long long>(latency.percentile(0.5)),
+                        static_cast<unsigned long long>(latency.percentile(0.99)));
+                if (serverPid > 0) {
+                    std::printf(" rss %lluKiB", static_cast<unsigned long long>(
+                            residentKiB(serverPid, "VmRSS:")));
+                }
+                std::printf("\n");
+                lastMessages = messages;
+            }
+
+            const double elapsed {elapsedMicros() / 1e6};
+            const double handshakeSeconds {
+                    std::max(lastHandshakeMicros.load() / 1e6, 1e-6)};
+            std::printf(
+                    "\nconnections  %zu (%llu failed)\n"
+                    "handshakes/s %.0f\n"
+                    "messages/s   %.0f (%llu sent, %llu received)\n"
+                    "games        %llu\n"
+                    "requests     %llu (%llu rejected)\n"
+                    "latency      p50 %lluus p99 %lluus p999 %lluus\n",
+                    connectionCount,
+                    static_cast<unsigned long long>(failures.load()),
+                    handshakes.load() / handshakeSeconds,
+                    (messagesSent.load() + messagesReceived.load()) / elapsed,
+                    static_cast<unsigned long long>(messagesSent.load()),
+                    static_cast<unsigned long long>(messagesReceived.load()),
+                    static_cast<unsigned long long>(gamesFinished.load()),
+                    static_cast<unsigned long long>(latency.count()),
+                    static_cast<unsigned long long>(rejected.load()),
+                    static_cast<unsigned long long>(latency.percentile(0.5)),
+                    static_cast<unsigned long long>(latency.percentile(0.99)),
+                    static_cast<unsigned long long>(latency.percentile(0.999)));
+            if (serverPid > 0) {
+                std::printf(
+                        "server rss   %lluKiB (peak %lluKiB)\n",
+                        static_cast<unsigned long long>(
+                                residentKiB(serverPid, "VmRSS:")),
+                        static_cast<unsigned long long>(
+                                residentKiB(serverPid, "VmHWM:")));
+            }
+
+            //Closing every socket ends the outstanding reads.
+            for (auto& session : sessions) {
+                withSocket(*session, [](auto& socket) {
+                    asio::post(socket.get_executor(), [&socket] {
+                        boost::system::error_code ignored {};
+                        beast::get_lowest_layer(socket).socket().close(ignored);
+                    });
+                });
+            }
+            work.reset();
+            for (auto& worker : workers) {
+                worker.join();
+            }
+            return 0;
+        }
+};
+
+int main(int argc, char* argv[]) {
+    std::string host {"127.0.0.1"};
+    std::string port {"443"};
+    std::size_t connectionCount {1000};
+    unsigned seconds {10};
+    unsigned threadCount {std::max(std::thread::hardware_concurrency(), 1u)};
+    long serverPid {0};
+    std::uint32_t seed {1};
+    bool matchmaking {false};
+    bool plaintext {false};
+    for (int i {1}; i < argc; ++i) {
+        const std::string argument {argv[i]};
+        const bool hasValue {i + 1 < argc};
+        if (argument == "--host" && hasValue) {
+            host = argv[++i];
+        }
+        else if (argument == "--port" && hasValue) {
+            port = argv[++i];
+        }
+        else if (argument == "--connections" && hasValue) {
+            connectionCount = std::max(std::atoi(argv[++i]), 1);
+        }
+        else if (argument == "--seconds" && hasValue) {
+            seconds = std::max(std::atoi(argv[++i]), 1);
+        }
+        else if (argument == "--threads" && hasValue) {
+            threadCount = std::max(std::atoi(argv[++i]), 1);
+        }
+        else if (argument == "--server-pid" && hasValue) {
+            serverPid = std::atol(argv[++i]);
+        }
+        else if (argument == "--seed" && hasValue) {
+            seed = static_cast<std::uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (argument == "--queue") {
+            matchmaking = true;
+        }
+        else if (argument == "--plaintext") {
+            plaintext = true;
+        }
+        else {
+            std::fprintf(stderr, "unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    LoadGenerator loadGenerator {host, port, matchmaking, plaintext};
+    return loadGenerator.run(
+            connectionCount, seconds, threadCount, serverPid, seed);
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include "game.hpp"
+
+//How likely a bid is to hold, from one player's point of view. Every answer
+//comes from binomial tail tables computed at compile time, so scoring every
+//possible bid is a few contiguous copies with no arithmetic on the hot path.
+namespace Probability {
+    //Rows are padded with ones on the left so a hand that already covers
+    //part of a bid just shifts the read position; no clamping is needed.
+    constexpr std::size_t rowPadding {Game::maxDice};
+    constexpr std::size_t rowSize {rowPadding + Game::maxDice + 2};
+
+    struct TailTable {
+        //at(n, k) = P(at least k successes in n trials)
+        alignas(32) std::array<std::array<float, rowSize>, Game::maxDice + 1>
+                rows {};
+
+        constexpr float at(const std::size_t n, const std::ptrdiff_t k) const {
+            return rows[n][rowPadding + k];
+        }
+    };
+
+    constexpr TailTable makeTailTable(const double p) {
+        //pmf[n][k] by the usual recurrence, then suffix sums per row.
+        std::array<std::array<double, Game::maxDice + 2>, Game::maxDice + 1>
+                pmf {};
+        pmf[0][0] = 1;
+        for (std::size_t n {1}; n <= Game::maxDice; ++n) {
+            pmf[n][0] = pmf[n - 1][0] * (1 - p);
+            for (std::size_t k {1}; k <= n; ++k) {
+                pmf[n][k] = pmf[n - 1][k] * (1 - p) + pmf[n - 1][k - 1] * p;
+            }
+        }
+        TailTable table {};
+        for (std::size_t n {0}; n <= Game::maxDice; ++n) {
+            for (std::size_t i {0}; i < rowPadding; ++i) {
+                table.rows[n][i] = 1;
+            }
+            double tail {0};
+            for (std::size_t k {Game::maxDice + 1}; k-- > 0;) {
+                tail += pmf[n][k];
+                table.rows[n][rowPadding + k] = static_cast<float>(
+                        tail > 1 ? 1 : tail);
+            }
+            table.rows[n][rowPadding + Game::maxDice + 1] = 0;
+        }
+        return table;
+    }
+
+    //A die shows a given face with probability 1/6, or 1/3 when ones are
+    //wild and the face is not 1.
+    inline constexpr TailTable plainTail {makeTailTable(1.0 / 6)};
+    inline constexpr TailTable wildTail {makeTailTable(1.0 / 3)};
+
+    //scores[face - 1][count] = P(bid of count x face holds). Counts run
+    //from 0 to maxDice; count 0 is always 1.
+    using BidScores = std::array<std::array<float, Game::maxDice + 1>,
+            Game::faceCount>;
+
+    //Scores every bid at once given the caller's hand and how many dice are
+    //hidden from them. Each face is a contiguous copy out of a table row.
+    inline void scoreBids(
+            const Game::Hand hand,
+            const unsigned unknownDice,
+            const std::uint8_t rules,
+            BidScores& scores) {
+        const bool wild {(rules & Game::Rules::WILD_ONES) != 0};
+        for (unsigned face {1}; face <= Game::faceCount; ++face) {
+            const TailTable& tail {wild && face != 1 ? wildTail : plainTail};
+            const unsigned mine {Game::matching(hand, face, rules)};
+            std::memcpy(
+                    scores[face - 1].data(),
+                    &tail.rows[unknownDice][rowPadding - mine],
+                    sizeof(scores[face - 1]));
+        }
+    }
+
+    struct Move {
+        bool challenge {false};
+        std::uint8_t count {0};
+        std::uint8_t face {0};
+    };
+
+    //Challenges when the standing bid is less likely to hold than the best
+    //raise, otherwise makes the likeliest raise (the lowest on ties).
+    inline Move bestMove(const Game::Table& table, const unsigned seat) {
+        BidScores scores;
+        const unsigned totalDice {table.totalDice()};
+        scoreBids(
+                table.hand(seat),
+                totalDice - table.dice(seat),
+                table.currentRules(),
+                scores);
+
+        const unsigned bidCount {table.currentBidCount()};
+        const unsigned bidFace {table.currentBidFace()};
+        Move best {};
+        float bestScore {-1};
+        for (unsigned count {bidCount == 0 ? 1 : bidCount};
+                count <= totalDice;
+                ++count) {
+            for (unsigned face {1}; face <= Game::faceCount; ++face) {
+                const bool raises {bidCount == 0
+                     || Game::bidRank(count, face)
+                      > Game::bidRank(bidCount, bidFace)};
+                const float score {scores[face - 1][count]};
+                if (raises && score > bestScore) {
+                    bestScore = score;
+                    best = {
+                            .count = static_cast<std::uint8_t>(count),
+                            .face = static_cast<std::uint8_t>(face)};
+                }
+            }
+        }
+        if (bidCount != 0
+         && 1 - scores[bidFace - 1][bidCount] >= bestScore) {
+            return {.challenge = true};
+        }
+        return best;
+    }
+}
@@ -0,0 +1,515 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+//Binary wire format shared by the server and the client.
+//
+//A websocket frame holds one or more messages back to back. Every message
+//starts with a 4 byte header:
+//    u8 version, u8 type, u16 payload length
+//followed by the payload. Integers are little-endian. Messages are decoded
+//straight out of the receive buffer and encoded by appending to a caller
+//owned buffer, so neither direction allocates once buffers are warm.
+namespace Protocol {
+    constexpr std::uint8_t version {1};
+    constexpr std::size_t headerSize {4};
+
+    enum class MessageType : std::uint8_t {
+        HELLO = 1,
+        WELCOME,
+        ERROR,
+        //lobby
+        CREATE_TABLE,
+        JOIN_TABLE,
+        LEAVE_TABLE,
+        TABLE_JOINED,
+        PLAYER_JOINED,
+        PLAYER_LEFT,
+        START_GAME,
+        //game
+        BID,
+        BID_MADE,
+        CHALLENGE,
+        DICE_REVEAL,
+        ROUND_STARTED,
+        CHALLENGE_RESULT,
+        GAME_OVER,
+        ADD_BOT,
+        //matchmaking
+        QUEUE,
+        CANCEL_QUEUE,
+        QUEUED,
+        //lobby listing
+        LOBBY_SUBSCRIBE,
+        LOBBY_UNSUBSCRIBE,
+        LOBBY_TABLE,
+        LOBBY_TABLE_REMOVED,
+        //reconnection
+        TABLE_VERSION,
+        RESUME,
+        TABLE_SNAPSHOT,
+        PLAYER_AWAY,
+        //matchmaking, continued
+        QUEUE_CANCELLED,
+    };
+
+    enum class ErrorCode : std::uint8_t {
+        BAD_MESSAGE = 1,
+        BAD_VERSION,
+        NO_SUCH_TABLE,
+        TABLE_FULL,
+        NOT_AT_TABLE,
+        NOT_YOUR_TURN,
+        ILLEGAL_BID,
+        ILLEGAL_CHALLENGE,
+        NOT_PLAYING,
+        QUEUE_FULL,
+        CANNOT_RESUME,
+    };
+
+    //Hands travel as per-face counts, 5 bits per face, face 1 lowest.
+    using PackedHand = std::uint32_t;
+    //Dice left per seat, 3 bits per seat, seat 0 lowest.
+    using PackedDiceCounts = std::uint32_t;
+    //TableJoined.seat for someone watching rather than playing.
+    constexpr std::uint8_t spectatorSeat {0xFF};
+
+    class Writer {
+        private:
+            std::vector<std::uint8_t>& out;
+
+        public:
+            explicit Writer(std::vector<std::uint8_t>& out) : out {out} {}
+
+            template <typename Integer>
+            void write(const Integer value) {
+                using Unsigned = std::make_unsigned_t<Integer>;
+                const auto bits {static_cast<Unsigned>(value)};
+                for (std::size_t i {0}; i < sizeof(Integer); ++i) {
+                    out.push_back(static_cast<std::uint8_t>(bits >> (8 * i)));
+                }
+            }
+            template <typename... Fields>
+            void operator()(const Fields&... fields) {
+                (write(fields), ...);
+            }
+    };
+
+    class Reader {
+        private:
+            std::span<const std::uint8_t> in;
+            bool failed {false};
+
+        public:
+            explicit Reader(const std::span<const std::uint8_t> in) : in {in} {}
+
+            template <typename Integer>
+            void read(Integer& value) {
+                if (in.size() < sizeof(Integer)) {
+                    failed = true;
+                    return;
+                }
+                std::make_unsigned_t<Integer> bits {0};
+                for (std::size_t i {0}; i < sizeof(Integer); ++i) {
+                    bits |= static_cast<decltype(bits)>(in[i]) << (8 * i);
+                }
+                value = static_cast<Integer>(bits);
+                in = in.subspan(sizeof(Integer));
+            }
+            template <typename... Fields>
+            void operator()(Fields&... fields) {
+                (read(fields), ...);
+            }
+
+            bool ok() const {
+                return !failed;
+            }
+    };
+
+    namespace HelloFlags {
+        //The player agrees to their games being recorded to train bots.
+        constexpr std::uint8_t TELEMETRY_OPT_IN {1 << 0};
+    }
+
+    //Each message lists its fields once, in wire order, in serialize().
+    struct Hello {
+        static constexpr MessageType type {MessageType::HELLO};
+        std::uint8_t clientVersion {version};
+        std::uint8_t flags {0};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(clientVersion, flags);
+        }
+    };
+    struct Welcome {
+        static constexpr MessageType type {MessageType::WELCOME};
+        std::uint32_t playerId {0};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(playerId);
+        }
+    };
+    struct Error {
+        static constexpr MessageType type {MessageType::ERROR};
+        ErrorCode code {ErrorCode::BAD_MESSAGE};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(code);
+        }
+    };
+    struct CreateTable {
+        static constexpr MessageType type {MessageType::CREATE_TABLE};
+        std::uint8_t seatCount {0};
+        std::uint8_t rules {0};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(seatCount, rules);
+        }
+    };
+    struct JoinTable {
+        static constexpr MessageType type {MessageType::JOIN_TABLE};
+        std::uint32_t tableId {0};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(tableId);
+        }
+    };
+    struct LeaveTable {
+        static constexpr MessageType type {MessageType::LEAVE_TABLE};
+        template <typename Archive> void serialize(Archive&) {}
+    };
+    //resumeToken reclaims the seat after a dropped connection; 0 for
+    //spectators. On joining it is followed by a TableSnapshot of the
+    //table as found, seats and bots included.
+    struct TableJoined {
+        static constexpr MessageType type {MessageType::TABLE_JOINED};
+        std::uint32_t tableId {0};
+        std::uint8_t seat {0};
+        std::uint64_t resumeToken {0};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(tableId, seat, resumeToken);
+        }
+    };
+    struct PlayerJoined {
+        static constexpr MessageType type {MessageType::PLAYER_JOINED};
+        std::uint8_t seat {0};
+        std::uint8_t bot {0};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(seat, bot);
+        }
+    };
+    //Mid-game, the seat's dice are forfeit, and the standing bid is
+    //withdrawn if it was theirs.
+    struct PlayerLeft {
+        static constexpr MessageType type {MessageType::PLAYER_LEFT};
+        std::uint8_t seat {0};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(seat);
+        }
+    };
+    //Fills the next free seat with a server-side bot.
+    struct AddBot {
+        static constexpr MessageType type {MessageType::ADD_BOT};
+        template <typename Archive> void serialize(Archive&) {}
+    };
+    struct StartGame {
+        static constexpr MessageType type {MessageType::START_GAME};
+        template <typename Archive> void serialize(Archive&) {}
+    };
+    struct Bid {
+        static constexpr MessageType type {MessageType::BID};
+        std::uint8_t count {0};
+        std::uint8_t face {0};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(count, face);
+        }
+    };
+    struct BidMade {
+        static constexpr MessageType type {MessageType::BID_MADE};
+        std::uint8_t seat {0};
+        std::uint8_t count {0};
+        std::uint8_t face {0};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(seat, count, face);
+        }
+    };
+    struct Challenge {
+        static constexpr MessageType type {MessageType::CHALLENGE};
+        template <typename Archive> void serialize(Archive&) {}
+    };
+    struct DiceReveal {
+        static constexpr MessageType type {MessageType::DICE_REVEAL};
+        std::uint8_t seat {0};
+        PackedHand hand {0};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(seat, hand);
+        }
+    };
+
+    //Sent to each seat (and spectators, with an empty hand) as a round
+    //begins; turn is the seat that opens the bidding.
+    struct RoundStarted {
+        static constexpr MessageType type {MessageType::ROUND_STARTED};
+        std::uint16_t round {0};
+        std::uint8_t turn {0};
+        PackedDiceCounts diceCounts {0};
+        PackedHand hand {0};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(round, turn, diceCounts, hand);
+        }
+    };
+    struct ChallengeResult {
+        static constexpr MessageType type {MessageType::CHALLENGE_RESULT};
+        std::uint8_t challenger {0};
+        std::uint8_t bidder {0};
+        std::uint8_t actual {0};
+        std::uint8_t loser {0};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(challenger, bidder, actual, loser);
+        }
+    };
+    struct GameOver {
+        static constexpr MessageType type {MessageType::GAME_OVER};
+        std::uint8_t winner {0};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(winner);
+        }
+    };
+
+    //Asks to be seated at a new table with seatCount players of about the
+    //same skill, all wanting the same rules. The table starts once full.
+    struct Queue {
+        static constexpr MessageType type {MessageType::QUEUE};
+        std::uint8_t seatCount {2};
+        std::uint8_t rules {0};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(seatCount, rules);
+        }
+    };
+    struct CancelQueue {
+        static constexpr MessageType type {MessageType::CANCEL_QUEUE};
+        template <typename Archive> void serialize(Archive&) {}
+    };
+    //Acknowledges Queue; TABLE_JOINED follows once matched.
+    struct Queued {
+        static constexpr MessageType type {MessageType::QUEUED};
+        std::uint8_t skillBand {0};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(skillBand);
+        }
+    };
+    //Answers CancelQueue. cancelled is 0 if a table had already been found,
+    //in which case TABLE_JOINED follows as if the cancel had not been sent.
+    struct QueueCancelled {
+        static constexpr MessageType type {MessageType::QUEUE_CANCELLED};
+        std::uint8_t cancelled {1};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(cancelled);
+        }
+    };
+
+    //Subscribing sends one LobbyTable per listed table, then a LobbyTable
+    //or LobbyTableRemoved whenever a listing changes.
+    struct LobbySubscribe {
+        static constexpr MessageType type {MessageType::LOBBY_SUBSCRIBE};
+        template <typename Archive> void serialize(Archive&) {}
+    };
+    struct LobbyUnsubscribe {
+        static constexpr MessageType type {MessageType::LOBBY_UNSUBSCRIBE};
+        template <typename Archive> void serialize(Archive&) {}
+    };
+    namespace LobbyState {
+        constexpr std::uint8_t SEATING {0};
+        constexpr std::uint8_t PLAYING {1};
+        constexpr std::uint8_t OVER {2};
+    }
+    struct LobbyTable {
+        static constexpr MessageType type {MessageType::LOBBY_TABLE};
+        std::uint32_t tableId {0};
+        std::uint8_t rules {0};
+        std::uint8_t seatCount {0};
+        std::uint8_t seated {0};
+        std::uint8_t state {LobbyState::SEATING};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(tableId, rules, seatCount, seated, state);
+        }
+        bool operator==(const LobbyTable&) const = default;
+    };
+    struct LobbyTableRemoved {
+        static constexpr MessageType type {MessageType::LOBBY_TABLE_REMOVED};
+        std::uint32_t tableId {0};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(tableId);
+        }
+    };
+
+    //Ends every frame a table sends to everyone at it: the events before
+    //it took the table to version.
+    struct TableVersion {
+        static constexpr MessageType type {MessageType::TABLE_VERSION};
+        std::uint32_t version {0};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(version);
+        }
+    };
+    //Takes a seat back after a dropped connection, in place of joining.
+    //version is the last TableVersion seen; the answer is TABLE_JOINED
+    //followed by the frames since then, or by one TableSnapshot if the
+    //table no longer has them.
+    struct Resume {
+        static constexpr MessageType type {MessageType::RESUME};
+        std::uint32_t tableId {0};
+        std::uint8_t seat {0};
+        std::uint64_t resumeToken {0};
+        std::uint32_t version {0};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(tableId, seat, resumeToken, version);
+        }
+    };
+    //Everything a seat can see, as of version. Masks have one bit per
+    //seat, seat 0 lowest.
+    struct TableSnapshot {
+        static constexpr MessageType type {MessageType::TABLE_SNAPSHOT};
+        std::uint32_t version {0};
+        std::uint8_t rules {0};
+        std::uint8_t seatCount {0};
+        //0 seating, 1 bidding, 2 between rounds, 3 game over
+        std::uint8_t phase {0};
+        std::uint8_t seated {0};
+        std::uint8_t bots {0};
+        std::uint8_t away {0};
+        std::uint16_t round {0};
+        std::uint8_t turn {0};
+        PackedDiceCounts diceCounts {0};
+        PackedHand hand {0};
+        std::uint8_t bidCount {0};
+        std::uint8_t bidFace {0};
+        std::uint8_t bidder {0};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(version, rules, seatCount, phase, seated, bots, away,
+                    round, turn, diceCounts, hand, bidCount, bidFace, bidder);
+        }
+    };
+    //The seat's connection dropped; it is kept for them for a while, and
+    //PLAYER_JOINED follows if they come back.
+    struct PlayerAway {
+        static constexpr MessageType type {MessageType::PLAYER_AWAY};
+        std::uint8_t seat {0};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(seat);
+        }
+    };
+
+    //Appends one message (header and payload) to out.
+    template <typename Message>
+    void encode(std::vector<std::uint8_t>& out, Message message) {
+        const std::size_t start {out.size()};
+        Writer writer {out};
+        writer(version, static_cast<std::uint8_t>(Message::type),
+                std::uint16_t{0});
+        message.serialize(writer);
+        const std::size_t length {out.size() - start - headerSize};
+        out[start + 2] = static_cast<std::uint8_t>(length);
+        out[start + 3] = static_cast<std::uint8_t>(length >> 8);
+    }
+
+    //A message inside a frame; payload points into the receive buffer.
+    struct View {
+        std::uint8_t version {0};
+        MessageType type {};
+        std::span<const std::uint8_t> payload {};
+    };
+
+    template <typename Message>
+    std::optional<Message> decode(const View& view) {
+        if (view.type != Message::type) {
+            return std::nullopt;
+        }
+        Message message {};
+        Reader reader {view.payload};
+        message.serialize(reader);
+        if (!reader.ok()) {
+            return std::nullopt;
+        }
+        return message;
+    }
+
+    //Iterates the messages of one frame without copying it. A truncated
+    //trailing message ends iteration and marks the frame as malformed.
+    class Frame {
+        private:
+            std::span<const std::uint8_t> bytes;
+
+        public:
+            explicit Frame(const std::span<const std::uint8_t> bytes)
+                  : bytes {bytes} {}
+            Frame(const void* data, const std::size_t size)
+                  : bytes {static_cast<const std::uint8_t*>(data), size} {}
+
+            class Iterator {
+                private:
+                    std::span<const std::uint8_t> rest {};
+                    View current {};
+
+                    void parse() {
+                        if (rest.size() < headerSize) {
+                            rest = {};
+                            return;
+                        }
+                        const std::size_t length {
+                                static_cast<std::size_t>(rest[2])
+                              | static_cast<std::size_t>(rest[3]) << 8};
+                        if (rest.size() < headerSize + length) {
+                            rest = {};
+                            return;
+                        }
+                        current = {
+                                .version = rest[0],
+                                .type = static_cast<MessageType>(rest[1]),
+                                .payload = rest.subspan(headerSize, length)};
+                    }
+
+                public:
+                    Iterator() = default;
+                    explicit Iterator(const std::span<const std::uint8_t> rest)
+                          : rest {rest} {
+                        parse();
+                    }
+
+                    const View& operator*() const {
+                        return current;
+                    }
+                    const View* operator->() const {
+                        return &current;
+                    }
+                    Iterator& operator++() {
+                        rest = rest.subspan(
+                                headerSize + current.payload.size());
+                        parse();
+                        return *this;
+                    }
+                    bool operator==(const Iterator& other) const {
+                        return rest.data() == other.rest.data()
+                            && rest.size() == other.rest.size();
+                    }
+            };
+
+            Iterator begin() const {
+                return Iterator{bytes};
+            }
+            Iterator end() const {
+                return Iterator{};
+            }
+
+            //True when the frame is a whole number of well-formed messages.
+            bool wellFormed() const {
+                std::size_t offset {0};
+                while (offset + headerSize <= bytes.size()) {
+                    offset += headerSize + (
+                            static_cast<std::size_t>(bytes[offset + 2])
+                          | static_cast<std::size_t>(bytes[offset + 3]) << 8);
+                }
+                return offset == bytes.size();
+            }
+    };
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+//Bounded multi-producer queue (Vyukov). Each cell carries a sequence
+//number saying whose turn it is, so producers only contend on one
+//counter and the consumer on none.
+template <typename T, std::size_t capacity>
+class Ring {
+    private:
+        static_assert((capacity & (capacity - 1)) == 0);
+
+        struct Cell {
+            std::atomic<std::size_t> sequence {0};
+            T value {};
+        };
+
+        std::unique_ptr<Cell[]> cells {std::make_unique<Cell[]>(capacity)};
+        alignas(64) std::atomic<std::size_t> enqueuePosition {0};
+        alignas(64) std::size_t dequeuePosition {0};
+
+    public:
+        Ring() {
+            for (std::size_t i {0}; i < capacity; ++i) {
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        //False if the queue is full.
+        bool push(const T& value) {
+            std::size_t position {
+                    enqueuePosition.load(std::memory_order_relaxed)};
+            while (true) {
+                Cell& cell {cells[position & (capacity - 1)]};
+                const std::size_t sequence {
+                        cell.sequence.load(std::memory_order_acquire)};
+                const auto difference {
+                        static_cast<std::ptrdiff_t>(sequence)
+                      - static_cast<std::ptrdiff_t>(position)};
+                if (difference == 0) {
+                    if (enqueuePosition.compare_exchange_weak(
+                            position,
+                            position + 1,
+                            std::memory_order_relaxed)) {
+                        cell.value = value;
+                        cell.sequence.store(
+                                position + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (difference < 0) {
+                    return false;
+                }
+                else {
+                    position = enqueuePosition.load(
+                            std::memory_order_relaxed);
+                }
+            }
+        }
+        //Single consumer only.
+        bool pop(T& value) {
+            Cell& cell {cells[dequeuePosition & (capacity - 1)]};
+            if (cell.sequence.load(std::memory_order_acquire)
+             != dequeuePosition + 1) {
+                return false;
+            }
+            value = cell.value;
+            cell.sequence.store(
+                    dequeuePosition + capacity, std::memory_order_release);
+            ++dequeuePosition;
+            return true;
+        }
+};
@@ -1,133 +1,2220 @@
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <bit>
+#include <chrono>
+#include <cerrno>
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <thread>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 #include <boost/beast.hpp>
 #include <boost/beast/ssl.hpp>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include "debug.hpp"
+#include "game.hpp"
+#include "probability.hpp"
+#include "protocol.hpp"
+#include "ring.hpp"
+#include "shard.hpp"
+#include "slab.hpp"
+#include "snapshot.hpp"
+#include "strategy.hpp"
+#include "telemetry.hpp"
+#include "tls.hpp"
 
 namespace beast = boost::beast;
 namespace asio = boost::asio;
 
 class Server {
+    public:
+        struct Config {
+            unsigned short port {443};
+            std::string certificate {"assets/pem/cert.pem"};
+            std::string privateKey {"assets/pem/key.pem"};
+            //Session ticket keys shared with other processes; see
+            //Tls::TicketKeys. Random per process if empty.
+            std::string ticketKeys {};
+            std::chrono::seconds ticketKeyLifetime {std::chrono::hours(12)};
+            //Speak plain ws:// for running behind a local TLS terminator.
+            bool plaintext {false};
+            std::string strategy {"assets/strategy.bin"};
+            std::size_t threadCount {
+                    std::max(std::thread::hardware_concurrency(), 1u)};
+            //How long a seat is kept for a player whose connection dropped
+            //mid-game before they forfeit it.
+            std::chrono::seconds reconnectGrace {30};
+            //Meanwhile, how long the table waits on them when it is their
+            //turn before a bot plays it for them.
+            std::chrono::seconds awayTurnTimeout {10};
+            //Processes sharing port, which one this is, and the directory
+            //where they listen for each other; see shard.hpp.
+            unsigned shardCount {1};
+            unsigned shardIndex {0};
+            std::string shardSockets {};
+            //Live tables are checkpointed to this file (.bin, per shard)
+            //and restored from it at startup; empty for neither.
+            std::string snapshot {"snapshot"};
+            std::chrono::milliseconds checkpointInterval {1000};
+            std::size_t snapshotSlots {1 << 16};
+            //Connections get handshakeTimeout to finish the TLS and
+            //websocket handshakes. A quiet one is pinged, and closed if
+            //nothing at all arrives for idleTimeout.
+            std::chrono::seconds handshakeTimeout {10};
+            std::chrono::seconds idleTimeout {60};
+            //Bigger websocket messages close the connection.
+            std::size_t maxMessageSize {4096};
+            //A connection with more than this waiting to be sent, on top of
+            //the write in flight, is not keeping up and is closed; a player
+            //can resume their seat from a fresh one.
+            std::size_t outboundLimit {1 << 20};
+            //The same for everything queued to another shard. A stream
+            //whose messages would go past it is closed.
+            std::size_t linkOutboundLimit {16 << 20};
+        };
+
     private:
+        //Handlers touching one connection or one table run on that object's
+        //strand, so they are serialized without locks while the io_context
+        //itself is run by a pool of worker threads.
+        using Strand = asio::strand<asio::io_context::executor_type>;
+
+        using TlsWebsocketStream = beast::websocket::stream<
+                beast::ssl_stream<beast::tcp_stream>>;
+        using PlainWebsocketStream = beast::websocket::stream<beast::tcp_stream>;
+
+        //Lives in playerStreams, so its address is stable for as long as the
+        //connection is open; the slot (and its buffer) is reused afterwards.
+        struct Table;
+
+        //Encoded messages that are sent unchanged to many streams.
+        using SharedFrame = std::shared_ptr<const std::vector<std::uint8_t>>;
+
+        struct ShardPeer;
+        //In place of a socket, for a stream standing in on this shard for a
+        //connection another shard has; what it sends goes back over peer.
+        struct Forwarded {
+            ShardPeer* peer {nullptr};
+            std::uint64_t stream {0};
+            std::uint32_t generation {0};
+        };
+
         struct PlayerStream {
-            beast::websocket::stream<beast::ssl_stream<
-                    beast::tcp_stream>> socket;
+            //Empty between connections.
+            std::variant<
+                    std::monostate,
+                    TlsWebsocketStream,
+                    PlainWebsocketStream,
+                    Forwarded> socket {};
             beast::flat_buffer message {};
+            //Replies encoded on this stream's strand, and shared frames
+            //queued for it, wait here until the current write finishes and
+            //then all go out together as one websocket message.
+            std::vector<std::uint8_t> outbound {};
+            std::vector<SharedFrame> queued {};
+            std::size_t queuedBytes {0};
+            std::vector<std::uint8_t> writingOutbound {};
+            std::vector<SharedFrame> writing {};
+            std::vector<asio::const_buffer> writeBuffers {};
+            //Set and read on this stream's strand only; whether the player is
+            //actually seated is up to the table.
+            std::shared_ptr<Table> table {};
+            std::uint32_t playerId {0};
+            bool telemetry {false};
+            //Whether playerStreamSession, and playerStreamWrite, are
+            //running; the slot is only released once neither is.
+            bool inSession {false};
+            bool writingInFlight {false};
+            bool closing {false};
+            std::atomic<std::uint32_t> generation {0};
+            //Debug::now() timestamps for the latency histograms.
+            std::uint64_t acceptedAt {0};
+            std::uint64_t readAt {0};
+            std::uint64_t writeReadAt {0};
+            //Where the player stands in matchmaking. QUEUE picks the next
+            //multiple of 8, t; then t + 1 while a shard is claiming them,
+            //t + 2 once matched and t + 3 once withdrawn. A stream leaving
+            //while claimed moves t + 1 to t + 5 and the shard withdraws it
+            //when it lets go. Only the shard moves t, t + 1 and t + 5 on
+            //and only the stream moves t + 2, so a cancel and a match never
+            //both win.
+            std::atomic<std::uint32_t> queueTicket {0};
+            //Elo-like, for matchmaking; per connection for now.
+            std::uint16_t rating {1000};
+            bool lobbySubscribed {false};
+            //Set while at a table on another shard; messages for it gather
+            //in forwarded until the read is done.
+            ShardPeer* remote {nullptr};
+            std::vector<std::uint8_t> forwarded {};
+        };
+
+        //Refers to a stream from another strand (a table, say). Everything
+        //done through it is posted to the stream's own strand and dropped
+        //if the slot has since been given to another connection.
+        struct PlayerHandle {
+            PlayerStream* stream {nullptr};
+            std::uint32_t generation {0};
+            asio::any_io_executor executor {};
+            std::uint32_t playerId {0};
+            bool telemetry {false};
+        };
+
+        //One broadcast frame, stamped with the version it took the table to.
+        struct LogEntry {
+            std::uint32_t version {0};
+            SharedFrame frame {};
+        };
+        //Enough for a few rounds at a full table.
+        static constexpr std::size_t logLength {64};
+
+        struct Table {
+            std::uint32_t id {0};
+            Strand strand;
+            Game::Table game {};
+            std::array<PlayerHandle, Game::maxSeats> seats {};
+            std::vector<PlayerHandle> spectators {};
+            //Seats played by the server.
+            std::uint8_t botMask {0};
+            std::uint64_t turnStartedAt {0};
+            //Matched players yet to arrive; the game starts when it hits 0.
+            std::uint8_t matchPending {0};
+            //Last listing sent to the lobby.
+            Protocol::LobbyTable listed {};
+            //Every broadcast moves the table to the next version. The most
+            //recent frames are kept so a player coming back is sent only
+            //what they missed.
+            std::uint32_t version {0};
+            std::deque<LogEntry> log {};
+            //How the current round started, and at which version; that
+            //frame differs per seat.
+            Protocol::RoundStarted roundStarted {};
+            std::uint32_t roundVersion {0};
+            std::array<std::uint64_t, Game::maxSeats> resumeTokens {};
+            //Seats held for players whose connection dropped.
+            std::uint8_t awayMask {0};
+            //Restored after a restart: bots wait until someone resumes or
+            //the grace period ends, rather than play on while everyone is
+            //still reconnecting.
+            bool botsHeld {false};
+            //Where the table is checkpointed, if anywhere, and whether it
+            //changed since.
+            unsigned snapshotSlot {Snapshot::noSlot};
+            std::uint64_t snapshotSequence {0};
+            bool dirty {false};
+            bool closed {false};
+        };
+
+        //What survives a restart: the game and who may resume which seat.
+        //Anyone who was connected comes back as away.
+        struct TableRecord {
+            std::uint32_t id {0};
+            std::uint32_t version {0};
+            std::uint32_t roundVersion {0};
+            std::uint8_t botMask {0};
+            Game::Table game {};
+            Protocol::RoundStarted roundStarted {};
+            std::array<std::uint64_t, Game::maxSeats> resumeTokens {};
+        };
+
+        //Matchmaking. Players wait in one shard per rules variant, table
+        //size and skill band. Stream strands push into the shard's
+        //lock-free queue and never wait; only the shard's own strand pops
+        //and seats them, so shards never contend with each other or with
+        //the streams.
+        static constexpr unsigned skillBands {4};
+        static constexpr unsigned ruleVariants {2};
+
+        struct QueueEntry {
+            PlayerHandle handle {};
+            std::uint32_t ticket {0};
+            std::uint64_t queuedAt {0};
         };
 
-        asio::io_context ioContext {};
+        struct MatchShard {
+            Strand strand;
+            std::uint8_t seatCount {2};
+            std::uint8_t rules {0};
+            Ring<QueueEntry, 1024> incoming {};
+            //Set while a drain is posted, so a burst of pushes posts one.
+            std::atomic<bool> draining {false};
+            //On the strand only, in arrival order.
+            std::deque<QueueEntry> waiting {};
+            std::vector<QueueEntry> claimed {};
+
+            explicit MatchShard(asio::io_context& ioContext)
+                  : strand {asio::make_strand(ioContext)} {}
+        };
+
+        //Another shard, through the link this one dialed (for streams here
+        //at tables there) or the one it dialed (for the reverse).
+        struct ShardPeer {
+            std::unique_ptr<Shard::Link> link {};
+            //Dialed: streams here at the peer's tables, by address.
+            std::unordered_map<std::uint64_t, PlayerHandle> forwarding {};
+            //Accepted: stand-ins for the peer's streams at tables here.
+            std::unordered_map<std::uint64_t, PlayerStream*> proxies {};
+        };
+        using ReusePort = asio::detail::socket_option::boolean<
+                SOL_SOCKET, SO_REUSEPORT>;
+
+        //Table listings, kept current by the tables themselves. Changes are
+        //gathered for a moment and pushed to subscribers as one frame.
+        struct Lobby {
+            Strand strand;
+            asio::steady_timer flushTimer;
+            std::unordered_map<std::uint32_t, Protocol::LobbyTable> listings {};
+            std::vector<PlayerHandle> subscribers {};
+            std::shared_ptr<std::vector<std::uint8_t>> pending {};
+
+            explicit Lobby(asio::io_context& ioContext)
+                  : strand {asio::make_strand(ioContext)},
+                    flushTimer {strand} {}
+        };
+
+        const Config config;
+        const std::size_t threadCount;
+        asio::io_context ioContext;
         asio::ip::tcp::acceptor tcpAcceptor {ioContext};
-        asio::ip::tcp::endpoint tcpEndpoint {asio::ip::tcp::v4(), 443};
-        asio::ssl::context sslContext {asio::ssl::context::tlsv12};
+        asio::ip::tcp::endpoint tcpEndpoint;
+        asio::ssl::context sslContext {asio::ssl::context::tls_server};
+        Tls::TicketKeys ticketKeys;
+        asio::steady_timer ticketKeyTimer {asio::make_strand(ioContext)};
         std::atomic<bool> accepting {false};
+        std::atomic<std::uint32_t> nextPlayerId {0};
+        const std::uint64_t seed {
+                std::random_device{}() 
+              | static_cast<std::uint64_t>(std::random_device{}()) << 32};
+
+        Telemetry::Log telemetry {shardFile("telemetry")};
+        //Optional; bots fall back to Probability::bestMove without it.
+        Strategy::Table strategy {};
+
+        std::mutex tablesMutex {};
+        std::unordered_map<std::uint32_t, std::shared_ptr<Table>> tables {};
+        std::uint32_t nextTableId {0};
 
-        std::vector<PlayerStream> playerStreams;
+        Snapshot::File<TableRecord> snapshot {
+                config.snapshot.empty()
+              ? std::string{} : shardFile(config.snapshot) + ".bin",
+                config.snapshotSlots};
+        //Ids of tables changed since their last checkpoint.
+        Ring<std::uint32_t, 1 << 16> dirtyTables {};
+        asio::steady_timer checkpointTimer {asio::make_strand(ioContext)};
+
+        Slab<PlayerStream> playerStreams {};
+        std::vector<std::thread> workers;
+
+        std::vector<std::unique_ptr<MatchShard>> matchShards {};
+        Lobby lobby {ioContext};
+
+        //By shard index, empty for this one.
+        std::vector<std::unique_ptr<ShardPeer>> shardPeers {};
+        //Accepted links, and those of them that have closed and wait to
+        //take the next dial (a restarted shard's, say), so they number at
+        //most one per other shard plus the one accepting.
+        std::mutex acceptedPeersMutex {};
+        std::vector<std::unique_ptr<ShardPeer>> acceptedPeers {};
+        std::vector<ShardPeer*> idlePeers {};
+        asio::local::stream_protocol::acceptor shardAcceptor {ioContext};
+
+        Debug::Counter acceptCount {"accepts"};
+        Debug::Counter acceptFailures {"accept failures"};
+        Debug::Counter handshakeFailures {"handshake failures"};
+        Debug::Counter openStreams {"open connections"};
+        Debug::Counter messagesIn {"messages in"};
+        Debug::Counter badFrames {"bad frames"};
+        Debug::Counter timeouts {"timeouts"};
+        Debug::Counter slowConsumers {"slow consumers"};
+        Debug::Counter writesOut {"writes"};
+        Debug::Counter bytesOut {"bytes out"};
+        Debug::Histogram acceptTime {"accept"};
+        //TCP accept to websocket open.
+        Debug::Histogram handshakeTime {"handshake"};
+        //A read completing to the next write completing on that stream.
+        Debug::Histogram readToWriteTime {"read to write"};
+        //How long players (not bots) take over their turn.
+        Debug::Histogram turnTime {"table turn"};
+        Debug::Histogram queueTime {"queue to seat"};
+        Debug::Reporter reporter {
+                shardFile("stats") + ".txt", std::chrono::seconds(1)};
+
+        //name, or name-<shard index> when sharded.
+        std::string shardFile(const std::string& name) const {
+            return config.shardCount > 1
+                  ? name + "-" + std::to_string(config.shardIndex)
+                  : name;
+        }
 
     public:
-        Server(const bool shouldStartAccepting = true) {
-            sslContext.set_options(
-                    asio::ssl::context::default_workarounds
-                  | asio::ssl::context::no_sslv2
-                  | asio::ssl::context::single_dh_use);
-            sslContext.use_certificate_chain_file("assets/pem/cert.pem");
-            sslContext.use_rsa_private_key_file(
-                    "assets/pem/key.pem", 
-                    asio::ssl::context::pem);
-            sslContext.use_tmp_dh_file("assets/pem/dh.pem");
+        explicit Server(Config config)
+              : config {std::move(config)},
+                threadCount {std::max<std::size_t>(this->config.threadCount, 1)},
+                ioContext {static_cast<int>(threadCount)},
+                tcpEndpoint {asio::ip::tcp::v4(), this->config.port},
+                ticketKeys {
+                        this->config.ticketKeys,
+                        this->config.ticketKeyLifetime} {
+            if (!this->config.plaintext) {
+                sslContext.set_options(
+                        asio::ssl::context::default_workarounds
+                      | asio::ssl::context::no_sslv2
+                      | asio::ssl::context::no_sslv3
+                      | asio::ssl::context::no_tlsv1
+                      | asio::ssl::context::no_tlsv1_1);
+                //Like a certificate that will not load, settings OpenSSL
+                //rejects end the server rather than fall back to defaults.
+                if (!Tls::configure(sslContext.native_handle())) {
+                    throw std::runtime_error(
+                            "TLS groups or cipher list rejected");
+                }
+                ticketKeys.install(sslContext.native_handle());
+                sslContext.use_certificate_chain_file(
+                        this->config.certificate);
+                //Any key type; ECDSA keys make handshakes cheaper still.
+                sslContext.use_private_key_file(
+                        this->config.privateKey,
+                        asio::ssl::context::pem);
+            }
+
+            strategy.open(this->config.strategy.c_str());
+
+            for (unsigned rules {0}; rules < ruleVariants; ++rules) {
+                for (unsigned seatCount {2}; seatCount <= Game::maxSeats; ++seatCount) {
+                    for (unsigned band {0}; band < skillBands; ++band) {
+                        auto shard {std::make_unique<MatchShard>(ioContext)};
+                        shard->seatCount = static_cast<std::uint8_t>(seatCount);
+                        shard->rules = static_cast<std::uint8_t>(rules);
+                        matchShards.push_back(std::move(shard));
+                    }
+                }
+            }
+
+            snapshot.restore([this](
+                    const unsigned slot,
+                    const std::uint64_t sequence,
+                    const TableRecord& record) {
+                restoreTable(slot, sequence, record);
+            });
+            //The count is saved with each checkpoint; the gap covers ids
+            //handed out after the last one.
+            if (const std::uint64_t playerIds {snapshot.counter()}; playerIds != 0) {
+                nextPlayerId = static_cast<std::uint32_t>(
+                        playerIds + restoredPlayerIdGap);
+            }
 
             tcpAcceptor.open(tcpEndpoint.protocol());
             tcpAcceptor.set_option(asio::socket_base::reuse_address(true));
+            if (this->config.shardCount > 1) {
+                tcpAcceptor.set_option(ReusePort{true});
+                openShardLinks();
+            }
             tcpAcceptor.bind(tcpEndpoint);
             tcpAcceptor.listen();
         }
 
-        static void playerStreamOnHandshake(
+        //Calls visit with whichever websocket stream is open; not for
+        //Forwarded streams.
+        template <typename Visit>
+        static decltype(auto) withSocket(
                 PlayerStream& playerStream,
-                const boost::system::error_code& error) {
-            Debug::log("handshake error, if any: %s\n", error.category().message(error.value()).c_str());
-            playerStream.socket.set_option(
-                    beast::websocket::stream_base::decorator(
-                    [](beast::websocket::response_type& response) {
-                        response.set(
-                                beast::http::field::server,
-                                "Liar's Dice Server");
-                    }));
-            playerStream.socket.async_accept(std::bind(
-                    &Server::playerStreamOnAccept,
-                    std::ref(playerStream),
-                    std::placeholders::_1));
-        }
-        static void playerStreamOnAccept(
+                Visit&& visit) {
+            if (auto* socket {
+                    std::get_if<PlainWebsocketStream>(&playerStream.socket)}) {
+                return visit(*socket);
+            }
+            return visit(std::get<TlsWebsocketStream>(playerStream.socket));
+        }
+
+        void closePlayerStream(PlayerStream& playerStream) {
+            //Runs on the stream's strand. Closing the socket cancels any
+            //outstanding read or write; the slot is released once the last
+            //of their handlers has run.
+            if (!playerStream.closing) {
+                playerStream.closing = true;
+                playerStreamUnqueue(playerStream, false);
+                playerStreamLeaveTable(playerStream, true);
+                playerStreamLobbyUnsubscribe(playerStream);
+                if (auto* socket {
+                        std::get_if<TlsWebsocketStream>(&playerStream.socket)}) {
+                    //Closing without a close_notify would otherwise evict
+                    //the session from the cache and block resumption.
+                    SSL* ssl {socket->next_layer().native_handle()};
+                    if (SSL_is_init_finished(ssl)) {
+                        SSL_set_shutdown(
+                                ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+                    }
+                }
+                boost::system::error_code ignored {};
+                if (const auto* forwarded {
+                        std::get_if<Forwarded>(&playerStream.socket)}) {
+                    //The shard with the connection closes it in turn.
+                    forwarded->peer->proxies.erase(forwarded->stream);
+                    forwarded->peer->link->send(
+                            {.stream = forwarded->stream,
+                             .generation = forwarded->generation},
+                            {});
+                }
+                else {
+                    withSocket(playerStream, [&](auto& socket) {
+                        beast::get_lowest_layer(socket).socket().close(ignored);
+                    });
+                }
+            }
+            if (playerStream.inSession || playerStream.writingInFlight) {
+                return;
+            }
+            if (!std::holds_alternative<Forwarded>(playerStream.socket)) {
+                openStreams.add(-1);
+            }
+            //Bumping the generation first lets handles to this stream notice
+            //the slot was reused.
+            ++playerStream.generation;
+            playerStream.socket = std::monostate{};
+            playerStreamTrim(playerStream);
+            playerStream.message.clear();
+            playerStream.outbound.clear();
+            playerStream.queued.clear();
+            playerStream.queuedBytes = 0;
+            playerStream.table.reset();
+            playerStream.playerId = 0;
+            playerStream.telemetry = false;
+            playerStream.closing = false;
+            playerStream.readAt = 0;
+            playerStream.writeReadAt = 0;
+            playerStream.rating = 1000;
+            playerStream.forwarded.clear();
+            playerStreams.release(playerStream);
+        }
+
+        PlayerHandle playerStreamHandle(PlayerStream& playerStream) {
+            const auto* forwarded {std::get_if<Forwarded>(&playerStream.socket)};
+            return {
+                    .stream = &playerStream,
+                    .generation = playerStream.generation,
+                    .executor = forwarded != nullptr
+                          ? forwarded->peer->link->executor()
+                          : withSocket(playerStream, [](auto& socket) {
+                                return asio::any_io_executor{
+                                        socket.get_executor()};
+                            }),
+                    .playerId = playerStream.playerId,
+                    .telemetry = playerStream.telemetry};
+        }
+
+        template <typename... Messages>
+        static std::shared_ptr<std::vector<std::uint8_t>> makeFrame(
+                const Messages&... messages) {
+            auto frame {std::make_shared<std::vector<std::uint8_t>>()};
+            (Protocol::encode(*frame, messages), ...);
+            return frame;
+        }
+
+        //Queues frame on the stream behind handle; callable from any strand.
+        void send(const PlayerHandle& handle, SharedFrame frame) {
+            asio::post(handle.executor, [this, handle, frame {std::move(frame)}]
+                    () mutable {
+                PlayerStream& playerStream {*handle.stream};
+                if (playerStream.generation != handle.generation
+                 || playerStream.closing) {
+                    return;
+                }
+                playerStream.queuedBytes += frame->size();
+                if (playerStream.outbound.size() + playerStream.queuedBytes
+                        > config.outboundLimit) {
+                    Debug::info("slow consumer: player %lld",
+                            playerStream.playerId);
+                    slowConsumers.add();
+                    closePlayerStream(playerStream);
+                    return;
+                }
+                playerStream.queued.push_back(std::move(frame));
+                playerStreamFlush(playerStream);
+            });
+        }
+        //Encoded once, shared by every recipient.
+        void broadcast(std::span<const PlayerHandle> handles, SharedFrame frame) {
+            for (const PlayerHandle& handle : handles) {
+                if (handle.stream != nullptr) {
+                    send(handle, frame);
+                }
+            }
+        }
+
+        //Moves everything waiting into the writing buffers.
+        void playerStreamTakeOutbound(PlayerStream& playerStream) {
+            std::swap(playerStream.outbound, playerStream.writingOutbound);
+            std::swap(playerStream.queued, playerStream.writing);
+            playerStream.queuedBytes = 0;
+            playerStream.writeBuffers.clear();
+            if (!playerStream.writingOutbound.empty()) {
+                playerStream.writeBuffers.push_back(
+                        asio::buffer(playerStream.writingOutbound));
+            }
+            for (const SharedFrame& frame : playerStream.writing) {
+                playerStream.writeBuffers.push_back(asio::buffer(*frame));
+            }
+        }
+        //Starts playerStreamWrite if there is anything to send and it is
+        //not already running.
+        void playerStreamFlush(PlayerStream& playerStream) {
+            if (playerStream.writingInFlight || playerStream.closing
+             || (playerStream.outbound.empty() && playerStream.queued.empty())) {
+                return;
+            }
+            if (const auto* forwarded {
+                    std::get_if<Forwarded>(&playerStream.socket)}) {
+                playerStreamTakeOutbound(playerStream);
+                const bool sent {forwarded->peer->link->send(
+                        {.stream = forwarded->stream,
+                         .generation = forwarded->generation},
+                        playerStream.writeBuffers)};
+                playerStream.writingOutbound.clear();
+                playerStream.writing.clear();
+                if (!sent) {
+                    slowConsumers.add();
+                    closePlayerStream(playerStream);
+                }
+                return;
+            }
+            playerStream.writingInFlight = true;
+            withSocket(playerStream, [&](auto& socket) {
+                asio::co_spawn(
+                        socket.get_executor(),
+                        playerStreamWrite(playerStream, socket),
+                        rethrow);
+            });
+        }
+
+        //Coroutines run on their stream's strand; an exception escaping one
+        //is as fatal as one escaping a handler.
+        static void rethrow(const std::exception_ptr exception) {
+            if (exception) {
+                std::rethrow_exception(exception);
+            }
+        }
+
+        //Buffers are kept this small between bursts, so an idle connection
+        //holds next to nothing of its own.
+        static constexpr std::size_t keptBufferSize {256};
+        //Except the read buffer: beast prepares at least 512 bytes for every
+        //read, and a whole frame's worth for the first, so it is only given
+        //back after a message far bigger than that.
+        static constexpr std::size_t keptReadBufferSize {64 << 10};
+
+        template <typename T>
+        static void trim(std::vector<T>& buffer) {
+            if (buffer.capacity() * sizeof(T) > keptBufferSize) {
+                std::vector<T>{}.swap(buffer);
+            }
+        }
+        //Not the read buffer, which a read in progress may be filling.
+        void playerStreamTrim(PlayerStream& playerStream) {
+            trim(playerStream.outbound);
+            trim(playerStream.queued);
+            trim(playerStream.writingOutbound);
+            trim(playerStream.writing);
+            trim(playerStream.writeBuffers);
+            trim(playerStream.forwarded);
+        }
+
+        //One connection from accept to close: handshakes, then a read loop
+        //handing each message to playerStreamOnRead. Writes run alongside
+        //in playerStreamWrite.
+        template <typename Socket>
+        asio::awaitable<void> playerStreamSession(
                 PlayerStream& playerStream,
-                const boost::system::error_code& error) {
-            Debug::log("socket accept error, if any: %s\n", error.category().message(error.value()).c_str());
-            {
-                playerStream.socket.async_read(
-                        playerStream.message,
-                        std::bind(
-                        &Server::playerStreamOnRead,
-                        std::ref(playerStream),
-                        std::placeholders::_1,
-                        std::placeholders::_2));
+                Socket& socket) {
+            playerStream.inSession = true;
+            boost::system::error_code error {};
+            auto onError {asio::redirect_error(asio::use_awaitable, error)};
+            auto& tcpStream {beast::get_lowest_layer(socket)};
+            if constexpr (std::is_same_v<Socket, TlsWebsocketStream>) {
+                tcpStream.expires_after(config.handshakeTimeout);
+                co_await socket.next_layer().async_handshake(
+                        asio::ssl::stream_base::server, onError);
+                tcpStream.expires_never();
+            }
+            if (!error) {
+                socket.set_option(beast::websocket::stream_base::timeout{
+                        .handshake_timeout = config.handshakeTimeout,
+                        .idle_timeout = config.idleTimeout,
+                        .keep_alive_pings = true});
+                socket.set_option(beast::websocket::stream_base::decorator(
+                        [](beast::websocket::response_type& response) {
+                            response.set(
+                                    beast::http::field::server,
+                                    "Liar's Dice Server");
+                        }));
+                socket.read_message_max(config.maxMessageSize);
+                socket.binary(true);
+                co_await socket.async_accept(onError);
+            }
+            if (error) {
+                Debug::info("handshake failed: %lld", error.value());
+                handshakeFailures.add();
+            }
+            else {
+                handshakeTime.record(Debug::microsSince(playerStream.acceptedAt));
+                while (!playerStream.closing) {
+                    const std::size_t transferSize {
+                            co_await socket.async_read(
+                                    playerStream.message, onError)};
+                    if (error) {
+                        break;
+                    }
+                    Debug::trace("read %lld bytes", transferSize);
+                    playerStreamOnRead(playerStream, socket.got_text());
+                }
+                Debug::trace("read ended: %lld", error.value());
+            }
+            if (error == beast::error::timeout) {
+                timeouts.add();
+            }
+            playerStream.inSession = false;
+            closePlayerStream(playerStream);
+        }
+        void playerStreamOnRead(PlayerStream& playerStream, const bool gotText) {
+            playerStream.readAt = Debug::now();
+            const Protocol::Frame frame {
+                    playerStream.message.cdata().data(),
+                    playerStream.message.size()};
+            if (gotText || !frame.wellFormed()) {
+                badFrames.add();
+                Protocol::encode(playerStream.outbound, Protocol::Error{
+                        .code = Protocol::ErrorCode::BAD_MESSAGE});
+            }
+            else {
+                for (const Protocol::View& view : frame) {
+                    playerStreamOnMessage(playerStream, view);
+                }
+            }
+            playerStream.message.consume(playerStream.message.size());
+            if (playerStream.message.capacity() > keptReadBufferSize) {
+                playerStream.message.shrink_to_fit();
+            }
+
+            playerStreamForwardFlush(playerStream);
+            playerStreamFlush(playerStream);
+            if (!playerStream.writingInFlight) {
+                playerStreamTrim(playerStream);
             }
         }
-        static void playerStreamOnRead(
+        //Sends until nothing is left, then trims the buffers and ends; it
+        //is started again by the next playerStreamFlush.
+        template <typename Socket>
+        asio::awaitable<void> playerStreamWrite(
                 PlayerStream& playerStream,
-                const boost::system::error_code& error,
-                std::size_t transferSize) {
-            Debug::log("socket read error, if any: %s\n", error.category().message(error.value()).c_str());
-            Debug::log("got %d bytes, are text: %d\n", transferSize, playerStream.socket.got_text());
-            reinterpret_cast<char*>(
-                    playerStream.message.data().data())[
-                            transferSize - 1] = '\0';
-            Debug::log(
-                    "received message: %s\n", 
-                    playerStream.message.cdata().data());
+                Socket& socket) {
+            boost::system::error_code error {};
+            while (!playerStream.closing
+             && (!playerStream.outbound.empty() || !playerStream.queued.empty())) {
+                playerStreamTakeOutbound(playerStream);
+                playerStream.writeReadAt = std::exchange(playerStream.readAt, 0);
+                const std::size_t transferSize {co_await socket.async_write(
+                        playerStream.writeBuffers,
+                        asio::redirect_error(asio::use_awaitable, error))};
+                playerStream.writingOutbound.clear();
+                playerStream.writing.clear();
+                if (error) {
+                    Debug::trace("write ended: %lld", error.value());
+                    break;
+                }
+                writesOut.add();
+                bytesOut.add(static_cast<std::int64_t>(transferSize));
+                if (playerStream.writeReadAt != 0) {
+                    readToWriteTime.record(
+                            Debug::microsSince(playerStream.writeReadAt));
+                    playerStream.writeReadAt = 0;
+                }
+            }
+            playerStream.writingInFlight = false;
+            if (error || playerStream.closing) {
+                closePlayerStream(playerStream);
+                co_return;
+            }
+            playerStreamTrim(playerStream);
+        }
+
+        void playerStreamOnMessage(
+                PlayerStream& playerStream,
+                const Protocol::View& view) {
+            messagesIn.add();
+            Debug::trace(
+                    "message type %lld, %lld bytes",
+                    static_cast<int>(view.type),
+                    view.payload.size());
+            if (view.version != Protocol::version) {
+                Protocol::encode(playerStream.outbound, Protocol::Error{
+                        .code = Protocol::ErrorCode::BAD_VERSION});
+                return;
+            }
+            if (playerStream.remote != nullptr && forwardsToTable(view.type)) {
+                playerStreamForward(playerStream, view);
+                return;
+            }
+            switch (view.type) {
+                case Protocol::MessageType::HELLO:
+                    if (const auto hello {
+                            Protocol::decode<Protocol::Hello>(view)}) {
+                        if (playerStream.playerId == 0) {
+                            playerStream.playerId = ++nextPlayerId
+                                  * config.shardCount + config.shardIndex;
+                        }
+                        playerStream.telemetry = (hello->flags 
+                              & Protocol::HelloFlags::TELEMETRY_OPT_IN) != 0;
+                        Protocol::encode(
+                                playerStream.outbound,
+                                Protocol::Welcome{
+                                        .playerId = playerStream.playerId});
+                        return;
+                    }
+                break;
+                case Protocol::MessageType::CREATE_TABLE:
+                    if (const auto request {
+                            Protocol::decode<Protocol::CreateTable>(view)}) {
+                        playerStreamUnqueue(playerStream, false);
+                        playerStreamLeaveTable(playerStream);
+                        playerStreamJoinTable(
+                                playerStream, 
+                                createTable(*request));
+                        return;
+                    }
+                break;
+                case Protocol::MessageType::JOIN_TABLE:
+                    if (const auto joinTable {
+                            Protocol::decode<Protocol::JoinTable>(view)}) {
+                        if (playerStreamRoute(
+                                playerStream, joinTable->tableId, view)) {
+                            return;
+                        }
+                        std::shared_ptr<Table> table {
+                                findTable(joinTable->tableId)};
+                        if (!table) {
+                            Protocol::encode(
+                                    playerStream.outbound, 
+                                    Protocol::Error{.code = 
+                                            Protocol::ErrorCode::NO_SUCH_TABLE});
+                            return;
+                        }
+                        playerStreamUnqueue(playerStream, false);
+                        playerStreamLeaveTable(playerStream);
+                        playerStreamJoinTable(playerStream, std::move(table));
+                        return;
+                    }
+                break;
+                case Protocol::MessageType::RESUME:
+                    if (const auto resume {
+                            Protocol::decode<Protocol::Resume>(view)}) {
+                        if (playerStreamRoute(
+                                playerStream, resume->tableId, view)) {
+                            return;
+                        }
+                        std::shared_ptr<Table> table {
+                                findTable(resume->tableId)};
+                        if (!table) {
+                            Protocol::encode(
+                                    playerStream.outbound, 
+                                    Protocol::Error{.code = 
+                                            Protocol::ErrorCode::NO_SUCH_TABLE});
+                            return;
+                        }
+                        playerStreamUnqueue(playerStream, false);
+                        playerStreamLeaveTable(playerStream);
+                        playerStream.table = std::move(table);
+                        asio::post(playerStream.table->strand, std::bind(
+                                &Server::tableResume,
+                                this,
+                                playerStream.table,
+                                playerStreamHandle(playerStream),
+                                *resume));
+                        return;
+                    }
+                break;
+                case Protocol::MessageType::LEAVE_TABLE:
+                    playerStreamLeaveTable(playerStream);
+                    return;
+                case Protocol::MessageType::START_GAME:
+                    if (playerStreamAtTable(playerStream)) {
+                        asio::post(playerStream.table->strand, std::bind(
+                                &Server::tableStart,
+                                this,
+                                playerStream.table,
+                                playerStreamHandle(playerStream)));
+                    }
+                    return;
+                case Protocol::MessageType::ADD_BOT:
+                    if (playerStreamAtTable(playerStream)) {
+                        asio::post(playerStream.table->strand, std::bind(
+                                &Server::tableAddBot,
+                                this,
+                                playerStream.table,
+                                playerStreamHandle(playerStream)));
+                    }
+                    return;
+                case Protocol::MessageType::BID:
+                    if (const auto bid {
+                            Protocol::decode<Protocol::Bid>(view)}) {
+                        if (playerStreamAtTable(playerStream)) {
+                            asio::post(playerStream.table->strand, std::bind(
+                                    &Server::tableBid,
+                                    this,
+                                    playerStream.table,
+                                    playerStreamHandle(playerStream),
+                                    *bid));
+                        }
+                        return;
+                    }
+                break;
+                case Protocol::MessageType::CHALLENGE:
+                    if (playerStreamAtTable(playerStream)) {
+                        asio::post(playerStream.table->strand, std::bind(
+                                &Server::tableChallenge,
+                                this,
+                                playerStream.table,
+                                playerStreamHandle(playerStream)));
+                    }
+                    return;
+                case Protocol::MessageType::QUEUE:
+                    if (const auto queue {
+                            Protocol::decode<Protocol::Queue>(view)}) {
+                        if (queue->seatCount >= 2
+                         && queue->seatCount <= Game::maxSeats
+                         && queue->rules < ruleVariants) {
+                            playerStreamLeaveTable(playerStream);
+                            playerStreamQueue(playerStream, *queue);
+                            return;
+                        }
+                    }
+                break;
+                case Protocol::MessageType::CANCEL_QUEUE:
+                    Protocol::encode(
+                            playerStream.outbound,
+                            Protocol::QueueCancelled{.cancelled = 
+                                    playerStreamUnqueue(playerStream, true)});
+                    return;
+                case Protocol::MessageType::LOBBY_SUBSCRIBE:
+                    if (!playerStream.lobbySubscribed) {
+                        playerStream.lobbySubscribed = true;
+                        asio::post(lobby.strand, std::bind(
+                                &Server::lobbySubscribe,
+                                this,
+                                playerStreamHandle(playerStream)));
+                    }
+                    return;
+                case Protocol::MessageType::LOBBY_UNSUBSCRIBE:
+                    playerStreamLobbyUnsubscribe(playerStream);
+                    return;
+                default:
+                break;
+            }
+            Protocol::encode(playerStream.outbound, Protocol::Error{
+                    .code = Protocol::ErrorCode::BAD_MESSAGE});
+        }
+
+        bool playerStreamAtTable(PlayerStream& playerStream) {
+            if (!playerStream.table) {
+                Protocol::encode(playerStream.outbound, Protocol::Error{
+                        .code = Protocol::ErrorCode::NOT_AT_TABLE});
+                return false;
+            }
+            return true;
+        }
+        void playerStreamJoinTable(
+                PlayerStream& playerStream,
+                std::shared_ptr<Table> table,
+                const bool matched = false) {
+            playerStream.table = table;
+            asio::post(table->strand, std::bind(
+                    matched ? &Server::tableMatchJoin : &Server::tableJoin,
+                    this,
+                    table,
+                    playerStreamHandle(playerStream)));
+        }
+        //A dropped connection may get its seat back; see tableDrop.
+        void playerStreamLeaveTable(
+                PlayerStream& playerStream,
+                const bool dropped = false) {
+            if (playerStream.remote != nullptr) {
+                if (!dropped) {
+                    Protocol::encode(
+                            playerStream.forwarded, Protocol::LeaveTable{});
+                }
+                playerStreamForwardFlush(playerStream, true);
+                return;
+            }
+            if (!playerStream.table) {
+                return;
+            }
+            asio::post(playerStream.table->strand, std::bind(
+                    dropped ? &Server::tableDrop : &Server::tableLeave,
+                    this,
+                    playerStream.table,
+                    playerStreamHandle(playerStream)));
+            playerStream.table.reset();
+        }
+
+        //Messages a stream at another shard's table sends on to it.
+        static bool forwardsToTable(const Protocol::MessageType type) {
+            switch (type) {
+                case Protocol::MessageType::START_GAME:
+                case Protocol::MessageType::ADD_BOT:
+                case Protocol::MessageType::BID:
+                case Protocol::MessageType::CHALLENGE:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+        //Sends a join or resume for another shard's table there; false if
+        //the table is this shard's.
+        bool playerStreamRoute(
+                PlayerStream& playerStream,
+                const std::uint32_t tableId,
+                const Protocol::View& view) {
+            const unsigned owner {Shard::owner(tableId, config.shardCount)};
+            if (owner == config.shardIndex) {
+                return false;
+            }
+            playerStreamUnqueue(playerStream, false);
+            playerStreamLeaveTable(playerStream);
+            playerStream.remote = shardPeers[owner].get();
+            playerStreamForward(playerStream, view);
+            return true;
+        }
+        void playerStreamForward(
+                PlayerStream& playerStream,
+                const Protocol::View& view) {
+            //The header sits right before the payload in the read buffer.
+            playerStream.forwarded.insert(
+                    playerStream.forwarded.end(),
+                    view.payload.data() - Protocol::headerSize,
+                    view.payload.data() + view.payload.size());
+        }
+        //Hands what was forwarded to the owning shard's link. Detaching
+        //also tells the owner this connection is done with its table.
+        void playerStreamForwardFlush(
+                PlayerStream& playerStream,
+                const bool detach = false) {
+            ShardPeer* peer {playerStream.remote};
+            if (peer == nullptr || (playerStream.forwarded.empty() && !detach)) {
+                return;
+            }
+            asio::post(peer->link->executor(), [
+                    this,
+                    peer,
+                    detach,
+                    handle {playerStreamHandle(playerStream)},
+                    payload {std::exchange(playerStream.forwarded, {})}] {
+                const Shard::Envelope envelope {
+                        .stream = reinterpret_cast<std::uintptr_t>(handle.stream),
+                        .generation = handle.generation,
+                        .playerId = handle.playerId,
+                        .telemetry = handle.telemetry};
+                if (!payload.empty()) {
+                    peer->forwarding.insert_or_assign(envelope.stream, handle);
+                    const asio::const_buffer buffer {asio::buffer(payload)};
+                    if (!peer->link->send(envelope, {&buffer, 1})) {
+                        slowConsumers.add();
+                        peer->forwarding.erase(envelope.stream);
+                        shardCloseForwarded(*peer, handle);
+                        return;
+                    }
+                }
+                if (detach) {
+                    peer->forwarding.erase(envelope.stream);
+                    peer->link->send(envelope, {});
+                }
+            });
+            if (detach) {
+                playerStream.remote = nullptr;
+            }
+        }
 
+        //What one envelope can carry: a read's worth of messages one way, a
+        //stream's whole outbound queue the other.
+        std::size_t largestPayload() const {
+            return std::max(config.maxMessageSize, config.outboundLimit);
+        }
+        //Sharded mode. Every shard dials every other one, for its own
+        //streams' messages, and accepts their dials, for theirs.
+        void openShardLinks() {
+            const std::string& directory {config.shardSockets};
+            const std::string path {
+                    Shard::socketPath(directory, config.shardIndex)};
+            std::error_code ignored {};
+            std::filesystem::create_directories(directory, ignored);
+            std::filesystem::remove(path, ignored);
+            shardAcceptor.open();
+            shardAcceptor.bind({path});
+            shardAcceptor.listen();
+
+            shardPeers.resize(config.shardCount);
+            for (unsigned shard {0}; shard < config.shardCount; ++shard) {
+                if (shard == config.shardIndex) {
+                    continue;
+                }
+                auto peer {std::make_unique<ShardPeer>()};
+                ShardPeer* raw {peer.get()};
+                peer->link = std::make_unique<Shard::Link>(
+                        ioContext,
+                        largestPayload(),
+                        config.linkOutboundLimit,
+                        [this, raw](
+                                const Shard::Envelope& envelope,
+                                const std::span<const std::uint8_t> payload) {
+                            shardOnDelivery(*raw, envelope, payload);
+                        },
+                        [this, raw] {
+                            shardOnOwnerLost(*raw);
+                        });
+                peer->link->connect(Shard::socketPath(directory, shard));
+                shardPeers[shard] = std::move(peer);
+            }
+        }
+        void shardAccept() {
+            ShardPeer* raw {nullptr};
             {
-                std::string message {"hello, world!"};
-                playerStream.socket.text(true);
-                playerStream.socket.async_write(
-                        asio::dynamic_buffer(message).data(),
-                        std::bind(
-                                &Server::playerStreamOnWrite,
-                                std::ref(playerStream),
-                                std::placeholders::_1,
-                                std::placeholders::_2));
-            }
-        }
-        static void playerStreamOnWrite(
+                const std::lock_guard lock {acceptedPeersMutex};
+                if (!idlePeers.empty()) {
+                    raw = idlePeers.back();
+                    idlePeers.pop_back();
+                }
+            }
+            if (raw == nullptr) {
+                auto peer {std::make_unique<ShardPeer>()};
+                raw = peer.get();
+                peer->link = std::make_unique<Shard::Link>(
+                        ioContext,
+                        largestPayload(),
+                        config.linkOutboundLimit,
+                        [this, raw](
+                                const Shard::Envelope& envelope,
+                                const std::span<const std::uint8_t> payload) {
+                            shardOnForward(*raw, envelope, payload);
+                        },
+                        [this, raw] {
+                            shardOnForwarderLost(*raw);
+                        });
+                const std::lock_guard lock {acceptedPeersMutex};
+                acceptedPeers.push_back(std::move(peer));
+            }
+            raw->link->accept(shardAcceptor, [this, raw](const bool opened) {
+                if (!opened) {
+                    const std::lock_guard lock {acceptedPeersMutex};
+                    idlePeers.push_back(raw);
+                }
+                if (accepting) {
+                    shardAccept();
+                }
+            });
+        }
+        //On the peer's link: messages from a stream over there, handled by
+        //a stand-in as if the stream were here.
+        void shardOnForward(
+                ShardPeer& peer,
+                const Shard::Envelope& envelope,
+                const std::span<const std::uint8_t> payload) {
+            PlayerStream* proxy {nullptr};
+            if (const auto found {peer.proxies.find(envelope.stream)};
+                    found != peer.proxies.end()) {
+                proxy = found->second;
+                if (payload.empty() || std::get<Forwarded>(proxy->socket)
+                        .generation != envelope.generation) {
+                    peer.proxies.erase(found);
+                    closePlayerStream(*proxy);
+                    proxy = nullptr;
+                }
+            }
+            if (payload.empty()) {
+                return;
+            }
+            if (proxy == nullptr) {
+                proxy = &playerStreams.acquire();
+                proxy->socket.emplace<Forwarded>(Forwarded{
+                        .peer = &peer,
+                        .stream = envelope.stream,
+                        .generation = envelope.generation});
+                proxy->playerId = envelope.playerId;
+                proxy->telemetry = envelope.telemetry != 0;
+                peer.proxies.emplace(envelope.stream, proxy);
+            }
+            for (const Protocol::View& view : Protocol::Frame{payload}) {
+                playerStreamOnMessage(*proxy, view);
+            }
+            playerStreamFlush(*proxy);
+        }
+        //On the peer's link: the owner's answer for a stream here.
+        void shardOnDelivery(
+                ShardPeer& peer,
+                const Shard::Envelope& envelope,
+                const std::span<const std::uint8_t> payload) {
+            const auto found {peer.forwarding.find(envelope.stream)};
+            if (found == peer.forwarding.end()
+             || found->second.generation != envelope.generation) {
+                return;
+            }
+            if (payload.empty()) {
+                shardCloseForwarded(peer, found->second);
+                peer.forwarding.erase(found);
+                return;
+            }
+            send(found->second, std::make_shared<std::vector<std::uint8_t>>(
+                    payload.begin(), payload.end()));
+        }
+        //Streams at the lost shard's tables are closed, so their players
+        //reconnect and resume once it is back.
+        void shardOnOwnerLost(ShardPeer& peer) {
+            for (const auto& [stream, handle] : peer.forwarding) {
+                shardCloseForwarded(peer, handle);
+            }
+            peer.forwarding.clear();
+        }
+        //From peer's link: closes a stream here whose table is there.
+        void shardCloseForwarded(ShardPeer& peer, const PlayerHandle& handle) {
+            asio::post(handle.executor, [this, &peer, handle] {
+                PlayerStream& playerStream {*handle.stream};
+                if (playerStream.generation == handle.generation
+                 && playerStream.remote == &peer) {
+                    playerStream.remote = nullptr;
+                    playerStream.forwarded.clear();
+                    closePlayerStream(playerStream);
+                }
+            });
+        }
+        //The stand-ins' connections are as good as dropped.
+        void shardOnForwarderLost(ShardPeer& peer) {
+            for (const auto& [stream, proxy] :
+                    std::exchange(peer.proxies, {})) {
+                closePlayerStream(*proxy);
+            }
+            const std::lock_guard lock {acceptedPeersMutex};
+            idlePeers.push_back(&peer);
+        }
+
+        void playerStreamQueue(
                 PlayerStream& playerStream,
-                const boost::system::error_code& error,
-                std::size_t transferSize) {
-            playerStream.message.clear();
-            Debug::log("socket write error, if any: %s\n", error.category().message(error.value()).c_str());
+                const Protocol::Queue& queue) {
+            const unsigned band {skillBand(playerStream.rating)};
+            MatchShard& shard {*matchShards[
+                    (queue.rules * (Game::maxSeats - 1) + queue.seatCount - 2)
+                  * skillBands + band]};
+            playerStreamUnqueue(playerStream, false);
+            const std::uint32_t ticket {
+                    (playerStream.queueTicket.load() | 7) + 1};
+            playerStream.queueTicket = ticket;
+            const QueueEntry entry {
+                    .handle = playerStreamHandle(playerStream),
+                    .ticket = ticket,
+                    .queuedAt = Debug::now()};
+            if (!shard.incoming.push(entry)) {
+                Protocol::encode(playerStream.outbound, Protocol::Error{
+                        .code = Protocol::ErrorCode::QUEUE_FULL});
+                return;
+            }
+            Protocol::encode(playerStream.outbound, Protocol::Queued{
+                    .skillBand = static_cast<std::uint8_t>(band)});
+            if (!shard.draining.exchange(true)) {
+                asio::post(shard.strand, std::bind(
+                        &Server::shardDrain, this, std::ref(shard)));
+            }
+        }
+        //Takes the player out of matchmaking. False if a table has already
+        //been found for them: keepMatch leaves them to be seated at it,
+        //otherwise they are withdrawn and it goes on without them. Never
+        //waits on a shard: one in the middle of claiming them is left to
+        //withdraw them, and a table it matches goes on without them.
+        bool playerStreamUnqueue(
+                PlayerStream& playerStream,
+                const bool keepMatch) {
+            std::uint32_t ticket {playerStream.queueTicket.load()};
+            while (true) {
+                switch (ticket & 7) {
+                    case 0:
+                        if (playerStream.queueTicket.compare_exchange_weak(
+                                ticket, ticket + 3)) {
+                            return true;
+                        }
+                    break;
+                    case 1:
+                        if (playerStream.queueTicket.compare_exchange_weak(
+                                ticket, ticket + 4)) {
+                            return true;
+                        }
+                    break;
+                    case 2:
+                        if (!keepMatch) {
+                            playerStream.queueTicket = ticket + 1;
+                        }
+                        return false;
+                    default:
+                        return true;
+                }
+            }
+        }
+        void playerStreamLobbyUnsubscribe(PlayerStream& playerStream) {
+            if (!playerStream.lobbySubscribed) {
+                return;
+            }
+            playerStream.lobbySubscribed = false;
+            asio::post(lobby.strand, std::bind(
+                    &Server::lobbyUnsubscribe,
+                    this,
+                    playerStreamHandle(playerStream)));
+        }
+
+        static unsigned skillBand(const unsigned rating) {
+            return std::min(
+                    rating < 800 ? 0 : (rating - 800) / 200,
+                    skillBands - 1);
+        }
+        //Nudges a player's rating from a table's strand.
+        void adjustRating(const PlayerHandle& handle, const int delta) {
+            asio::post(handle.executor, [handle, delta] {
+                if (handle.stream->generation != handle.generation) {
+                    return;
+                }
+                handle.stream->rating = static_cast<std::uint16_t>(
+                        std::clamp(handle.stream->rating + delta, 0, 4000));
+            });
+        }
+
+        //Whether the player is still waiting on this entry, rather than
+        //cancelled, queued again or disconnected.
+        static bool queueWaiting(const QueueEntry& entry) {
+            const PlayerStream& stream {*entry.handle.stream};
+            return stream.generation == entry.handle.generation
+                && stream.queueTicket.load() == entry.ticket;
+        }
+        //Matches everyone in shard.claimed or nobody: each is marked as
+        //being claimed, then all as matched, or all back to waiting if one
+        //withdrew in the meantime. One that asks to leave while claimed is
+        //withdrawn here instead (see playerStreamUnqueue).
+        static bool queueClaim(MatchShard& shard) {
+            std::size_t held {0};
+            for (; held < shard.claimed.size(); ++held) {
+                std::uint32_t ticket {shard.claimed[held].ticket};
+                if (!shard.claimed[held].handle.stream->queueTicket
+                        .compare_exchange_strong(ticket, ticket + 1)) {
+                    break;
+                }
+            }
+            const bool matched {held == shard.claimed.size()};
+            for (std::size_t i {0}; i < held; ++i) {
+                const QueueEntry& entry {shard.claimed[i]};
+                std::uint32_t ticket {entry.ticket + 1};
+                if (!entry.handle.stream->queueTicket.compare_exchange_strong(
+                        ticket, entry.ticket + (matched ? 2 : 0))) {
+                    //Unless they have since queued again.
+                    ticket = entry.ticket + 5;
+                    entry.handle.stream->queueTicket.compare_exchange_strong(
+                            ticket, entry.ticket + 3);
+                }
+            }
+            return matched;
+        }
+        //First come, first seated. Nobody is claimed until a table's worth
+        //are still waiting, so a cancel never leaves anyone claimed. Work
+        //per drain is proportional to what arrived, what was cancelled and
+        //what gets seated, however many are waiting.
+        void shardDrain(MatchShard& shard) {
+            shard.draining = false;
+            QueueEntry entry {};
+            while (shard.incoming.pop(entry)) {
+                shard.waiting.push_back(entry);
+            }
+            while (true) {
+                shard.claimed.clear();
+                while (shard.claimed.size() < shard.seatCount
+                    && !shard.waiting.empty()) {
+                    entry = shard.waiting.front();
+                    shard.waiting.pop_front();
+                    if (queueWaiting(entry)) {
+                        shard.claimed.push_back(entry);
+                    }
+                }
+                if (shard.claimed.size() == shard.seatCount
+                 && queueClaim(shard)) {
+                    shardSeat(shard);
+                    continue;
+                }
+                std::erase_if(shard.claimed, [](const QueueEntry& claimed) {
+                    return !queueWaiting(claimed);
+                });
+                shard.waiting.insert(
+                        shard.waiting.begin(),
+                        shard.claimed.begin(),
+                        shard.claimed.end());
+                if (shard.claimed.size() < shard.seatCount
+                 && shard.waiting.size() == shard.claimed.size()) {
+                    shard.claimed.clear();
+                    return;
+                }
+            }
+        }
+        //The table is handed to its own strand; each player joins it from
+        //their stream's strand, as if they had sent JOIN_TABLE.
+        void shardSeat(MatchShard& shard) {
+            const std::shared_ptr<Table> table {createTable({
+                    .seatCount = shard.seatCount,
+                    .rules = shard.rules})};
+            table->matchPending = shard.seatCount;
+            for (const QueueEntry& claimed : shard.claimed) {
+                queueTime.record(Debug::microsSince(claimed.queuedAt));
+                asio::post(claimed.handle.executor, [this, claimed, table] {
+                    PlayerStream& playerStream {*claimed.handle.stream};
+                    //Gone, or withdrawn by joining a table of their own
+                    //since the match.
+                    if (playerStream.generation != claimed.handle.generation
+                     || playerStream.closing
+                     || playerStream.queueTicket != claimed.ticket + 2) {
+                        asio::post(table->strand, std::bind(
+                                &Server::tableMatchArrived, this, table));
+                        return;
+                    }
+                    playerStream.queueTicket = claimed.ticket + 3;
+                    playerStreamLeaveTable(playerStream);
+                    playerStreamJoinTable(playerStream, table, true);
+                });
+            }
+            shard.claimed.clear();
+        }
+
+        void lobbySubscribe(const PlayerHandle& handle) {
+            lobby.subscribers.push_back(handle);
+            auto frame {std::make_shared<std::vector<std::uint8_t>>()};
+            for (const auto& [id, listing] : lobby.listings) {
+                Protocol::encode(*frame, listing);
+            }
+            if (!frame->empty()) {
+                send(handle, std::move(frame));
+            }
+        }
+        void lobbyUnsubscribe(const PlayerHandle& handle) {
+            std::erase_if(lobby.subscribers, [&](const PlayerHandle& other) {
+                return sameStream(other, handle);
+            });
+        }
+        //Where diffs go until the next flush, which this schedules.
+        std::vector<std::uint8_t>& lobbyPending() {
+            if (!lobby.pending) {
+                lobby.pending = std::make_shared<std::vector<std::uint8_t>>();
+                lobby.flushTimer.expires_after(std::chrono::milliseconds(50));
+                lobby.flushTimer.async_wait(
+                        [this](const boost::system::error_code&) {
+                            lobbyFlush();
+                        });
+            }
+            return *lobby.pending;
+        }
+        void lobbyUpdate(const Protocol::LobbyTable& listing) {
+            lobby.listings[listing.tableId] = listing;
+            Protocol::encode(lobbyPending(), listing);
+        }
+        void lobbyRemove(const std::uint32_t tableId) {
+            if (lobby.listings.erase(tableId) != 0) {
+                Protocol::encode(lobbyPending(), Protocol::LobbyTableRemoved{
+                        .tableId = tableId});
+            }
+        }
+        void lobbyFlush() {
+            const SharedFrame frame {std::move(lobby.pending)};
+            lobby.pending.reset();
+            std::erase_if(lobby.subscribers, [](const PlayerHandle& handle) {
+                return handle.stream->generation != handle.generation;
+            });
+            broadcast(lobby.subscribers, frame);
+        }
+
+        std::shared_ptr<Table> createTable(
+                const Protocol::CreateTable& request) {
+            auto table {std::make_shared<Table>(Table{
+                    .strand {asio::make_strand(ioContext)}})};
+            std::lock_guard lock {tablesMutex};
+            table->id = ++nextTableId * config.shardCount + config.shardIndex;
+            //splitmix64, so neighbouring tables get unrelated dice
+            std::uint64_t tableSeed {seed + table->id * 0x9E3779B97F4A7C15ull};
+            tableSeed = (tableSeed ^ (tableSeed >> 30)) * 0xBF58476D1CE4E5B9ull;
+            tableSeed = (tableSeed ^ (tableSeed >> 27)) * 0x94D049BB133111EBull;
+            table->game = Game::Table{
+                    tableSeed ^ (tableSeed >> 31),
+                    request.seatCount,
+                    request.rules};
+            table->snapshotSlot = snapshot.acquire();
+            tables.emplace(table->id, table);
+            return table;
+        }
+        //Versions jump past anything a client saw before the restart, so
+        //every resume gets a snapshot.
+        static constexpr std::uint32_t restoredVersionGap {1 << 16};
+        //More players than greet one shard between two checkpoints.
+        static constexpr std::uint32_t restoredPlayerIdGap {1 << 18};
+
+        void restoreTable(
+                const unsigned slot,
+                const std::uint64_t sequence,
+                const TableRecord& record) {
+            auto table {std::make_shared<Table>(Table{
+                    .strand {asio::make_strand(ioContext)}})};
+            table->id = record.id;
+            table->game = record.game;
+            table->botMask = record.botMask;
+            table->version = record.version + restoredVersionGap;
+            table->roundVersion = record.roundVersion;
+            table->roundStarted = record.roundStarted;
+            table->resumeTokens = record.resumeTokens;
+            table->snapshotSlot = slot;
+            table->snapshotSequence = sequence;
+            table->botsHeld = true;
+            {
+                std::lock_guard lock {tablesMutex};
+                tables.emplace(table->id, table);
+                nextTableId = std::max(nextTableId, table->id / config.shardCount);
+            }
+            for (unsigned seat {0}; seat < Game::maxSeats; ++seat) {
+                if (table->resumeTokens[seat] != 0) {
+                    tableHoldSeat(table, seat);
+                }
+            }
+            //Nobody to come back for it.
+            if (table->awayMask == 0) {
+                table->closed = true;
+                snapshot.release(slot);
+                std::lock_guard lock {tablesMutex};
+                tables.erase(table->id);
+                return;
+            }
+            tablePublish(*table);
+        }
+        //Queues a changed table for the next checkpoint.
+        void tableTouch(Table& table) {
+            if (table.snapshotSlot == Snapshot::noSlot || table.dirty) {
+                return;
+            }
+            table.dirty = dirtyTables.push(table.id);
+        }
+        //Copies one table into its slot, on its own strand, so nothing else
+        //waits for it.
+        void tableCheckpoint(Table& table) {
+            if (table.closed) {
+                return;
+            }
+            table.dirty = false;
+            snapshot.write(table.snapshotSlot, ++table.snapshotSequence, {
+                    .id = table.id,
+                    .version = table.version,
+                    .roundVersion = table.roundVersion,
+                    .botMask = table.botMask,
+                    .game = table.game,
+                    .roundStarted = table.roundStarted,
+                    .resumeTokens = table.resumeTokens});
+        }
+        //Handshakes only read the published keys; loading or generating
+        //the next ones happens here.
+        void rotateTicketKeys() {
+            ticketKeyTimer.expires_after(ticketKeys.lifetime());
+            ticketKeyTimer.async_wait([this](const boost::system::error_code& error) {
+                if (!error) {
+                    ticketKeys.rotate();
+                    rotateTicketKeys();
+                }
+            });
+        }
+        //Each dirty table writes itself on its own strand; the last one to
+        //finish flushes the file and schedules the next pass.
+        void checkpoint() {
+            snapshot.setCounter(nextPlayerId.load(std::memory_order_relaxed));
+            //One for each table posted, plus one dropped below.
+            auto pending {std::make_shared<std::atomic<std::size_t>>(1)};
+            std::uint32_t id {0};
+            while (dirtyTables.pop(id)) {
+                if (std::shared_ptr<Table> table {findTable(id)}) {
+                    pending->fetch_add(1, std::memory_order_relaxed);
+                    asio::post(table->strand, [this, table, pending] {
+                        tableCheckpoint(*table);
+                        checkpointWritten(pending);
+                    });
+                }
+            }
+            checkpointWritten(pending);
+        }
+        void checkpointWritten(
+                const std::shared_ptr<std::atomic<std::size_t>>& pending) {
+            if (pending->fetch_sub(1, std::memory_order_acq_rel) != 1) {
+                return;
+            }
+            asio::post(checkpointTimer.get_executor(), [this] {
+                checkpointFlush();
+            });
+        }
+        void checkpointFlush() {
+            snapshot.flush();
+            checkpointTimer.expires_after(config.checkpointInterval);
+            checkpointTimer.async_wait([this](const boost::system::error_code& error) {
+                if (!error) {
+                    checkpoint();
+                }
+            });
+        }
+
+        std::shared_ptr<Table> findTable(const std::uint32_t id) {
+            std::lock_guard lock {tablesMutex};
+            const auto found {tables.find(id)};
+            return found == tables.end() ? nullptr : found->second;
+        }
+
+        static bool sameStream(const PlayerHandle& a, const PlayerHandle& b) {
+            return a.stream == b.stream && a.generation == b.generation;
+        }
+        static Protocol::ErrorCode errorFor(const Game::Result result) {
+            switch (result) {
+                case Game::Result::NOT_YOUR_TURN:
+                    return Protocol::ErrorCode::NOT_YOUR_TURN;
+                case Game::Result::ILLEGAL_BID:
+                    return Protocol::ErrorCode::ILLEGAL_BID;
+                case Game::Result::ILLEGAL_CHALLENGE:
+                    return Protocol::ErrorCode::ILLEGAL_CHALLENGE;
+                case Game::Result::TABLE_FULL:
+                    return Protocol::ErrorCode::TABLE_FULL;
+                default:
+                    return Protocol::ErrorCode::NOT_PLAYING;
+            }
+        }
+
+        //The table* functions run on the table's strand.
+        unsigned tableSeatOf(const Table& table, const PlayerHandle& handle) {
+            for (unsigned seat {0}; seat < Game::maxSeats; ++seat) {
+                if (sameStream(table.seats[seat], handle)) {
+                    return seat;
+                }
+            }
+            return Game::maxSeats;
+        }
+        //Ends frame with the table's next version and keeps it for resumes.
+        SharedFrame tableStamp(
+                Table& table,
+                std::shared_ptr<std::vector<std::uint8_t>> frame) {
+            Protocol::encode(*frame, Protocol::TableVersion{
+                    .version = ++table.version});
+            table.log.push_back({.version = table.version, .frame = frame});
+            if (table.log.size() > logLength) {
+                table.log.pop_front();
+            }
+            tableTouch(table);
+            return frame;
+        }
+        void tableBroadcast(
+                Table& table,
+                std::shared_ptr<std::vector<std::uint8_t>> frame) {
+            const SharedFrame stamped {tableStamp(table, std::move(frame))};
+            broadcast(table.seats, stamped);
+            broadcast(table.spectators, stamped);
+        }
+        void tableError(
+                const PlayerHandle& handle,
+                const Protocol::ErrorCode code) {
+            send(handle, makeFrame(Protocol::Error{.code = code}));
+        }
+
+        //Seats on a table still waiting for its matched players are kept
+        //for them; anyone else watches.
+        void tableJoin(
+                const std::shared_ptr<Table>& table,
+                const PlayerHandle& handle) {
+            tableAdmit(*table, handle, table->matchPending == 0);
+            tablePublish(*table);
+        }
+        void tableMatchJoin(
+                const std::shared_ptr<Table>& table,
+                const PlayerHandle& handle) {
+            tableAdmit(*table, handle, true);
+            tableMatchArrived(table);
+        }
+        //A matched player arrived, or never will; the game starts once all
+        //of them are accounted for.
+        void tableMatchArrived(const std::shared_ptr<Table>& table) {
+            if (table->matchPending == 0 || --table->matchPending != 0) {
+                tablePublish(*table);
+                return;
+            }
+            if (table->game.start() == Game::Result::OK) {
+                tableSendRound(*table);
+                tableRunBots(table);
+            }
+            tablePublish(*table);
+        }
+        //Everyone already there hears of the new seat first; the joiner
+        //then gets TableJoined and a snapshot that includes it.
+        void tableAdmit(
+                Table& table,
+                const PlayerHandle& handle,
+                const bool mayPlay) {
+            const unsigned seat {mayPlay
+                    ? table.game.seat()
+                    : static_cast<unsigned>(Game::maxSeats)};
+            if (seat < Game::maxSeats) {
+                table.resumeTokens[seat] = newResumeToken();
+                tableBroadcast(table, makeFrame(Protocol::PlayerJoined{
+                        .seat = static_cast<std::uint8_t>(seat)}));
+                table.seats[seat] = handle;
+            }
+            else {
+                table.spectators.push_back(handle);
+            }
+            send(handle, makeFrame(
+                    Protocol::TableJoined{
+                            .tableId = table.id,
+                            .seat = seat < Game::maxSeats
+                                  ? static_cast<std::uint8_t>(seat)
+                                  : Protocol::spectatorSeat,
+                            .resumeToken = seat < Game::maxSeats
+                                  ? table.resumeTokens[seat]
+                                  : 0},
+                    tableSnapshot(table, seat)));
+        }
+        void tableLeave(
+                const std::shared_ptr<Table>& table,
+                const PlayerHandle& handle) {
+            const unsigned seat {tableSeatOf(*table, handle)};
+            if (seat < Game::maxSeats) {
+                tableUnseat(table, seat, &handle);
+            }
+            else {
+                std::erase_if(table->spectators, [&](const PlayerHandle& other) {
+                    return sameStream(other, handle);
+                });
+            }
+            tableTidy(table);
+        }
+        //Frees seat; leaving a game in progress forfeits it.
+        void tableUnseat(
+                const std::shared_ptr<Table>& table,
+                const unsigned seat,
+                const PlayerHandle* leaver) {
+            const bool wasPlaying {
+                    table->game.currentPhase() != Game::Phase::GAME_OVER};
+            table->game.unseat(seat);
+            table->seats[seat] = {};
+            table->resumeTokens[seat] = 0;
+            table->awayMask &= ~(1 << seat);
+            auto frame {std::make_shared<std::vector<std::uint8_t>>()};
+            Protocol::encode(*frame, Protocol::PlayerLeft{
+                    .seat = static_cast<std::uint8_t>(seat)});
+            if (wasPlaying 
+             && table->game.currentPhase() == Game::Phase::GAME_OVER) {
+                Protocol::encode(*frame, Protocol::GameOver{
+                        .winner = table->game.winner()});
+                tableRate(*table, leaver);
+            }
+            tableBroadcast(*table, frame);
+            tableRunBots(table);
+        }
+        //Mid-game, a dropped player's seat is held for them to resume; it is
+        //forfeited if they are not back within the grace period.
+        void tableDrop(
+                const std::shared_ptr<Table>& table,
+                const PlayerHandle& handle) {
+            const unsigned seat {tableSeatOf(*table, handle)};
+            const Game::Phase phase {table->game.currentPhase()};
+            if (seat >= Game::maxSeats
+             || phase == Game::Phase::SEATING
+             || phase == Game::Phase::GAME_OVER) {
+                tableLeave(table, handle);
+                return;
+            }
+            table->seats[seat] = {};
+            tableHoldSeat(table, seat);
+            tableBroadcast(*table, makeFrame(Protocol::PlayerAway{
+                    .seat = static_cast<std::uint8_t>(seat)}));
+            tableRunBots(table);
+        }
+        void tableHoldSeat(const std::shared_ptr<Table>& table, const unsigned seat) {
+            table->awayMask |= 1 << seat;
+            auto timer {std::make_shared<asio::steady_timer>(
+                    table->strand, config.reconnectGrace)};
+            timer->async_wait([this, table, seat, timer,
+                    token {table->resumeTokens[seat]}]
+                    (const boost::system::error_code&) {
+                const bool botsReleased {std::exchange(table->botsHeld, false)};
+                if (((table->awayMask >> seat) & 1) != 0
+                 && table->resumeTokens[seat] == token) {
+                    tableUnseat(table, seat, nullptr);
+                    tableTidy(table);
+                }
+                else if (botsReleased) {
+                    tableRunBots(table);
+                }
+            });
+        }
+        void tableResume(
+                const std::shared_ptr<Table>& table,
+                const PlayerHandle& handle,
+                const Protocol::Resume& resume) {
+            const unsigned seat {resume.seat};
+            if (seat >= Game::maxSeats
+             || table->resumeTokens[seat] == 0
+             || table->resumeTokens[seat] != resume.resumeToken) {
+                tableError(handle, Protocol::ErrorCode::CANNOT_RESUME);
+                return;
+            }
+            //Whoever held the seat until now (a connection that has not
+            //noticed it is dead, say) gets nothing more.
+            table->seats[seat] = handle;
+            table->awayMask &= ~(1 << seat);
+            table->resumeTokens[seat] = newResumeToken();
+            send(handle, makeFrame(Protocol::TableJoined{
+                    .tableId = table->id,
+                    .seat = static_cast<std::uint8_t>(seat),
+                    .resumeToken = table->resumeTokens[seat]}));
+            tableCatchUp(*table, seat, resume.version);
+            tableBroadcast(*table, makeFrame(Protocol::PlayerJoined{
+                    .seat = static_cast<std::uint8_t>(seat)}));
+            if (table->botsHeld) {
+                table->botsHeld = false;
+                tableRunBots(table);
+            }
+            tablePublish(*table);
+        }
+        //The logged frames after seen, shared with everyone who got them
+        //the first time, or a snapshot when some have been dropped.
+        void tableCatchUp(
+                Table& table,
+                const unsigned seat,
+                const std::uint32_t seen) {
+            const bool logged {seen == table.version || (seen < table.version
+                 && !table.log.empty() && seen + 1 >= table.log.front().version)};
+            if (!logged) {
+                send(table.seats[seat], makeFrame(tableSnapshot(table, seat)));
+                return;
+            }
+            for (const LogEntry& entry : table.log) {
+                if (entry.version <= seen) {
+                    continue;
+                }
+                send(table.seats[seat], entry.version == table.roundVersion
+                        ? tableRoundFrame(table, seat)
+                        : entry.frame);
+            }
+        }
+        Protocol::TableSnapshot tableSnapshot(
+                const Table& table,
+                const unsigned seat) {
+            const Game::Table& game {table.game};
+            return {
+                    .version = table.version,
+                    .rules = game.currentRules(),
+                    .seatCount = static_cast<std::uint8_t>(game.seatCapacity()),
+                    .phase = static_cast<std::uint8_t>(game.currentPhase()),
+                    .seated = game.occupiedMask(),
+                    .bots = table.botMask,
+                    .away = table.awayMask,
+                    .round = game.currentRound(),
+                    .turn = game.currentTurn(),
+                    .diceCounts = game.packedDiceCounts(),
+                    .hand = seat < Game::maxSeats ? game.hand(seat) : 0,
+                    .bidCount = static_cast<std::uint8_t>(game.currentBidCount()),
+                    .bidFace = static_cast<std::uint8_t>(game.currentBidFace()),
+                    .bidder = game.currentBidder()};
+        }
+        static std::uint64_t newResumeToken() {
+            std::uint64_t token {0};
+            while (token == 0) {
+                RAND_bytes(reinterpret_cast<unsigned char*>(&token), sizeof(token));
+            }
+            return token;
+        }
+        //Closes the table once nobody is left at it, else relists it.
+        void tableTidy(const std::shared_ptr<Table>& table) {
+            if (!tableHasPeople(*table)) {
+                if (table->closed) {
+                    return;
+                }
+                table->closed = true;
+                if (table->snapshotSlot != Snapshot::noSlot) {
+                    snapshot.release(table->snapshotSlot);
+                }
+                {
+                    std::lock_guard lock {tablesMutex};
+                    tables.erase(table->id);
+                }
+                asio::post(lobby.strand, std::bind(
+                        &Server::lobbyRemove, this, table->id));
+                return;
+            }
+            tablePublish(*table);
+        }
+        void tableStart(
+                const std::shared_ptr<Table>& table,
+                const PlayerHandle& handle) {
+            if (tableSeatOf(*table, handle) >= Game::maxSeats) {
+                tableError(handle, Protocol::ErrorCode::NOT_AT_TABLE);
+                return;
+            }
+            const Game::Result result {table->game.start()};
+            if (result != Game::Result::OK) {
+                tableError(handle, errorFor(result));
+                return;
+            }
+            tableSendRound(*table);
+            tableRunBots(table);
+            tablePublish(*table);
+        }
+        //Winner takes a stake from every other human who played; bots
+        //neither give nor take. A forfeit is gone from its seat already.
+        void tableRate(Table& table, const PlayerHandle* forfeited = nullptr) {
+            static constexpr int stake {8};
+            const unsigned winner {table.game.winner()};
+            int losers {0};
+            for (unsigned seat {0}; seat < Game::maxSeats; ++seat) {
+                if (seat != winner && table.seats[seat].stream != nullptr) {
+                    adjustRating(table.seats[seat], -stake);
+                    ++losers;
+                }
+            }
+            if (forfeited != nullptr) {
+                adjustRating(*forfeited, -stake);
+                ++losers;
+            }
+            if (winner < Game::maxSeats
+             && table.seats[winner].stream != nullptr) {
+                adjustRating(table.seats[winner], stake * losers);
+            }
+        }
+        //Tells the lobby if what it shows for this table is out of date.
+        void tablePublish(Table& table) {
+            const Game::Phase phase {table.game.currentPhase()};
+            const Protocol::LobbyTable listing {
+                    .tableId = table.id,
+                    .rules = table.game.currentRules(),
+                    .seatCount = static_cast<std::uint8_t>(
+                            table.game.seatCapacity()),
+                    .seated = static_cast<std::uint8_t>(
+                            table.game.seatedCount()),
+                    .state = phase == Game::Phase::SEATING
+                           ? Protocol::LobbyState::SEATING
+                           : phase == Game::Phase::GAME_OVER
+                           ? Protocol::LobbyState::OVER
+                           : Protocol::LobbyState::PLAYING};
+            if (listing == table.listed) {
+                return;
+            }
+            table.listed = listing;
+            asio::post(lobby.strand, std::bind(
+                    &Server::lobbyUpdate, this, listing));
+        }
+        //Hands are private, so every seat gets its own frame; the log keeps
+        //the one spectators get.
+        void tableSendRound(Table& table) {
+            table.roundStarted = {
+                    .round = table.game.currentRound(),
+                    .turn = table.game.currentTurn(),
+                    .diceCounts = table.game.packedDiceCounts()};
+            const SharedFrame spectated {
+                    tableStamp(table, makeFrame(table.roundStarted))};
+            table.roundVersion = table.version;
+            for (unsigned seat {0}; seat < Game::maxSeats; ++seat) {
+                if (table.seats[seat].stream != nullptr) {
+                    send(table.seats[seat], tableRoundFrame(table, seat));
+                }
+            }
+            broadcast(table.spectators, spectated);
+            table.turnStartedAt = Debug::now();
+        }
+        SharedFrame tableRoundFrame(const Table& table, const unsigned seat) {
+            Protocol::RoundStarted own {table.roundStarted};
+            own.hand = table.game.hand(seat);
+            return makeFrame(
+                    own,
+                    Protocol::TableVersion{.version = table.roundVersion});
+        }
+        void tableEndTurn(Table& table, const unsigned seat) {
+            if (((table.botMask >> seat) & 1) == 0) {
+                turnTime.record(Debug::microsSince(table.turnStartedAt));
+            }
+            table.turnStartedAt = Debug::now();
+        }
+        void tableBid(
+                const std::shared_ptr<Table>& table,
+                const PlayerHandle& handle,
+                const Protocol::Bid& bid) {
+            const unsigned seat {tableSeatOf(*table, handle)};
+            if (seat >= Game::maxSeats) {
+                tableError(handle, Protocol::ErrorCode::NOT_AT_TABLE);
+                return;
+            }
+            const Game::Result result {
+                    tablePlayBid(table, seat, bid.count, bid.face)};
+            if (result != Game::Result::OK) {
+                tableError(handle, errorFor(result));
+            }
+        }
+        void tableChallenge(
+                const std::shared_ptr<Table>& table,
+                const PlayerHandle& handle) {
+            const unsigned seat {tableSeatOf(*table, handle)};
+            if (seat >= Game::maxSeats) {
+                tableError(handle, Protocol::ErrorCode::NOT_AT_TABLE);
+                return;
+            }
+            const Game::Result result {tablePlayChallenge(table, seat)};
+            if (result != Game::Result::OK) {
+                tableError(handle, errorFor(result));
+            }
+        }
+        void tableAddBot(
+                const std::shared_ptr<Table>& table,
+                const PlayerHandle& handle) {
+            if (tableSeatOf(*table, handle) >= Game::maxSeats) {
+                tableError(handle, Protocol::ErrorCode::NOT_AT_TABLE);
+                return;
+            }
+            const unsigned seat {table->game.seat()};
+            if (seat >= Game::maxSeats) {
+                tableError(handle, Protocol::ErrorCode::TABLE_FULL);
+                return;
+            }
+            table->botMask |= 1 << seat;
+            tableBroadcast(*table, makeFrame(Protocol::PlayerJoined{
+                    .seat = static_cast<std::uint8_t>(seat),
+                    .bot = 1}));
+            tablePublish(*table);
+        }
+
+        //Seat-level moves shared by players and bots; they broadcast the
+        //outcome and hand the turn to a bot if one is up next.
+        Game::Result tablePlayBid(
+                const std::shared_ptr<Table>& table,
+                const unsigned seat,
+                const unsigned count,
+                const unsigned face) {
+            const Game::Hand hand {table->game.hand(seat)};
+            const Game::Result result {table->game.bid(seat, count, face)};
+            if (result != Game::Result::OK) {
+                return result;
+            }
+            tableEndTurn(*table, seat);
+            if (table->seats[seat].telemetry) {
+                telemetry.record({
+                        .tableId = table->id,
+                        .playerId = table->seats[seat].playerId,
+                        .hand = hand,
+                        .kind = Telemetry::Kind::BID,
+                        .seat = static_cast<std::uint8_t>(seat),
+                        .a = static_cast<std::uint8_t>(count),
+                        .b = static_cast<std::uint8_t>(face)});
+            }
+            tableBroadcast(*table, makeFrame(Protocol::BidMade{
+                    .seat = static_cast<std::uint8_t>(seat),
+                    .count = static_cast<std::uint8_t>(count),
+                    .face = static_cast<std::uint8_t>(face)}));
+            tableRunBots(table);
+            return result;
+        }
+        Game::Result tablePlayChallenge(
+                const std::shared_ptr<Table>& table,
+                const unsigned seat) {
+            const unsigned bidCount {table->game.currentBidCount()};
+            const unsigned bidFace {table->game.currentBidFace()};
+            const Game::ChallengeOutcome outcome {
+                    table->game.challenge(seat)};
+            if (outcome.result != Game::Result::OK) {
+                return outcome.result;
+            }
+            tableEndTurn(*table, seat);
+            tableRecordChallenge(*table, outcome, bidCount, bidFace);
+            //The result and every hand go out as one frame.
+            auto frame {std::make_shared<std::vector<std::uint8_t>>()};
+            Protocol::encode(*frame, Protocol::ChallengeResult{
+                    .challenger = outcome.challenger,
+                    .bidder = outcome.bidder,
+                    .actual = outcome.actual,
+                    .loser = outcome.loser});
+            for (unsigned other {0}; other < Game::maxSeats; ++other) {
+                if (table->game.hand(other) != 0) {
+                    Protocol::encode(*frame, Protocol::DiceReveal{
+                            .seat = static_cast<std::uint8_t>(other),
+                            .hand = table->game.hand(other)});
+                }
+            }
+            if (table->game.currentPhase() == Game::Phase::GAME_OVER) {
+                Protocol::encode(*frame, Protocol::GameOver{
+                        .winner = table->game.winner()});
+                tableBroadcast(*table, frame);
+                tableRate(*table);
+                tablePublish(*table);
+                return outcome.result;
+            }
+            tableBroadcast(*table, frame);
+            table->game.startRound();
+            tableSendRound(*table);
+            tableRunBots(table);
+            return outcome.result;
+        }
+
+        //Heads-up positions the solver covered are played from its table,
+        //everything else from the bid probabilities.
+        Probability::Move botMove(const Game::Table& game, const unsigned seat) {
+            const unsigned active {game.activeMask()};
+            if (strategy.loaded() && std::popcount(active) == 2) {
+                thread_local std::mt19937 random {std::random_device{}()};
+                const unsigned opponent {static_cast<unsigned>(
+                        std::countr_zero(active & ~(1u << seat)))};
+                const auto move {strategy.choose(
+                        game.dice(seat),
+                        game.dice(opponent),
+                        game.currentRules(),
+                        game.hand(seat),
+                        game.currentBidCount(),
+                        game.currentBidFace(),
+                        static_cast<std::uint32_t>(random()))};
+                if (move) {
+                    return *move;
+                }
+            }
+            return Probability::bestMove(game, seat);
+        }
+
+        //Hands are still those of the round being challenged.
+        void tableRecordChallenge(
+                const Table& table,
+                const Game::ChallengeOutcome& outcome,
+                const unsigned bidCount,
+                const unsigned bidFace) {
+            const PlayerHandle& challenger {table.seats[outcome.challenger]};
+            if (challenger.telemetry) {
+                telemetry.record({
+                        .tableId = table.id,
+                        .playerId = challenger.playerId,
+                        .hand = table.game.hand(outcome.challenger),
+                        .kind = Telemetry::Kind::CHALLENGE,
+                        .seat = outcome.challenger,
+                        .a = static_cast<std::uint8_t>(bidCount),
+                        .b = static_cast<std::uint8_t>(bidFace)});
+            }
+            if (std::any_of(
+                    table.seats.begin(),
+                    table.seats.end(),
+                    [](const PlayerHandle& seat) {
+                        return seat.telemetry;
+                    })) {
+                telemetry.record({
+                        .tableId = table.id,
+                        .kind = Telemetry::Kind::OUTCOME,
+                        .seat = outcome.loser,
+                        .a = outcome.actual,
+                        .b = outcome.challenger});
+            }
+        }
+
+        bool tableHasPeople(const Table& table) {
+            return !table.spectators.empty()
+                || table.awayMask != 0
+                || std::any_of(
+                        table.seats.begin(),
+                        table.seats.end(),
+                        [](const PlayerHandle& seat) {
+                            return seat.stream != nullptr;
+                        });
+        }
+        //Bot moves are posted rather than played inline so a table full of
+        //bots still yields its strand between moves. An away player's turn
+        //is played the same way once awayTurnTimeout passes with nothing
+        //else happening at the table, so one dropped connection does not
+        //stall everyone for the whole grace period.
+        void tableRunBots(const std::shared_ptr<Table>& table) {
+            const unsigned turn {table->game.currentTurn()};
+            if (table->botsHeld
+             || table->game.currentPhase() != Game::Phase::BIDDING
+             || (((table->botMask | table->awayMask) >> turn) & 1) == 0
+             || !tableHasPeople(*table)) {
+                return;
+            }
+            if (((table->awayMask >> turn) & 1) != 0) {
+                auto timer {std::make_shared<asio::steady_timer>(
+                        table->strand, config.awayTurnTimeout)};
+                timer->async_wait([this, table, turn, timer,
+                        version {table->version}]
+                        (const boost::system::error_code&) {
+                    if (table->version == version
+                     && !table->botsHeld
+                     && ((table->awayMask >> turn) & 1) != 0) {
+                        tablePlayBot(table, turn);
+                    }
+                });
+                return;
+            }
+            asio::post(table->strand, [this, table] {
+                const unsigned seat {table->game.currentTurn()};
+                if (((table->botMask >> seat) & 1) != 0) {
+                    tablePlayBot(table, seat);
+                }
+            });
+        }
+        void tablePlayBot(const std::shared_ptr<Table>& table, const unsigned seat) {
+            if (table->game.currentPhase() != Game::Phase::BIDDING
+             || table->game.currentTurn() != seat) {
+                return;
+            }
+            const Probability::Move move {botMove(table->game, seat)};
+            if (move.challenge) {
+                tablePlayChallenge(table, seat);
+            }
+            else {
+                tablePlayBid(table, seat, move.count, move.face);
+            }
         }
 
         void serverOnAccept(
                 const boost::system::error_code& error,
                 asio::ip::tcp::socket socket) {
-            Debug::log(
-                    "%s%s%s%s", 
-                    "accepting connection",
-                    (error ? " with error message " : ""),
-                    (error ? error.category().message(
-                            error.value()).c_str() : ""),
-                    "\n");
-            playerStreams.push_back({.socket{std::move(socket), sslContext}});
-            playerStreams.back().socket.next_layer().async_handshake(
-                    asio::ssl::stream_base::server,
-                    std::bind(
-                            &Server::playerStreamOnHandshake,
-                            std::ref(playerStreams.back()),
-                            std::placeholders::_1));
-            Debug::log("%s", "finished accepting connection\n");
+            const std::uint64_t start {Debug::now()};
+            if (error) {
+                Debug::warn("accept failed: %lld", error.value());
+                acceptFailures.add();
+            }
+            else {
+                acceptCount.add();
+                openStreams.add();
+                PlayerStream& playerStream {playerStreams.acquire()};
+                playerStream.acceptedAt = start;
+                if (config.plaintext) {
+                    playerStream.socket.emplace<PlainWebsocketStream>(
+                            std::move(socket));
+                }
+                else {
+                    playerStream.socket.emplace<TlsWebsocketStream>(
+                            std::move(socket), sslContext);
+                }
+                withSocket(playerStream, [&](auto& socket) {
+                    asio::co_spawn(
+                            socket.get_executor(),
+                            playerStreamSession(playerStream, socket),
+                            rethrow);
+                });
+            }
+            acceptTime.record(Debug::microsSince(start));
             if (accepting) {
-                Debug::log("%s", "queueing accept\n");
-                tcpAcceptor.async_accept(ioContext, std::bind(
+                tcpAcceptor.async_accept(asio::make_strand(ioContext), std::bind(
                         &Server::serverOnAccept,
                         this,
                         std::placeholders::_1,
@@ -139,23 +2226,199 @@ class Server {
             ioContext.stop();
 
             accepting = true;
-            Debug::log("%s", "queueing accept\n");
-            tcpAcceptor.async_accept(ioContext, std::bind(
+            tcpAcceptor.async_accept(asio::make_strand(ioContext), std::bind(
                     &Server::serverOnAccept,
                     this,
                     std::placeholders::_1,
                     std::placeholders::_2));
+            if (config.shardCount > 1) {
+                shardAccept();
+            }
+            asio::post(checkpointTimer.get_executor(), [this] {
+                checkpoint();
+            });
+            if (!config.plaintext) {
+                asio::post(ticketKeyTimer.get_executor(), [this] {
+                    rotateTicketKeys();
+                });
+            }
 
             ioContext.restart();
+            //The calling thread is one of the workers.
+            workers.reserve(threadCount - 1);
+            for (std::size_t i {1}; i < threadCount; ++i) {
+                workers.emplace_back([this] { ioContext.run(); });
+            }
             ioContext.run();
+            for (auto& worker : workers) {
+                worker.join();
+            }
+            workers.clear();
         }
+
         void stopAccepting() {
             accepting = false;
         }
 };
 
+//    server [--port N] [--cert PATH] [--key PATH] [--ticket-keys PATH]
+//           [--ticket-key-hours N] [--plaintext] [--strategy PATH]
+//           [--threads N] [--reconnect-seconds N] [--away-turn-seconds N]
+//           [--shards N]
+//           [--shard-sockets DIR] [--snapshot PATH | --no-snapshot]
+//           [--checkpoint-ms N] [--handshake-seconds N] [--idle-seconds N]
+//           [--outbound-kb N]
+//
+//With --shards, that many processes share the port, each running --threads
+//threads (the cores split between them by default), under a parent that
+//restarts any that die. Tables in play are
+//checkpointed to PATH.bin (PATH-<shard>.bin when sharded) and come back,
+//their players away, when the server restarts.
 int main(int argc, char* argv[]) {
-    Server server {};
+    Server::Config config {};
+    bool threadsGiven {false};
+    for (int i {1}; i < argc; ++i) {
+        const std::string argument {argv[i]};
+        const bool hasValue {i + 1 < argc};
+        if (argument == "--port" && hasValue) {
+            config.port = static_cast<unsigned short>(std::atoi(argv[++i]));
+        }
+        else if (argument == "--cert" && hasValue) {
+            config.certificate = argv[++i];
+        }
+        else if (argument == "--key" && hasValue) {
+            config.privateKey = argv[++i];
+        }
+        else if (argument == "--ticket-keys" && hasValue) {
+            config.ticketKeys = argv[++i];
+        }
+        else if (argument == "--ticket-key-hours" && hasValue) {
+            config.ticketKeyLifetime = std::chrono::hours(
+                    std::max(std::atoi(argv[++i]), 1));
+        }
+        else if (argument == "--plaintext") {
+            config.plaintext = true;
+        }
+        else if (argument == "--strategy" && hasValue) {
+            config.strategy = argv[++i];
+        }
+        else if (argument == "--threads" && hasValue) {
+            config.threadCount = std::max(std::atoi(argv[++i]), 1);
+            threadsGiven = true;
+        }
+        else if (argument == "--reconnect-seconds" && hasValue) {
+            config.reconnectGrace = std::chrono::seconds(
+                    std::max(std::atoi(argv[++i]), 0));
+        }
+        else if (argument == "--away-turn-seconds" && hasValue) {
+            config.awayTurnTimeout = std::chrono::seconds(
+                    std::max(std::atoi(argv[++i]), 0));
+        }
+        else if (argument == "--handshake-seconds" && hasValue) {
+            config.handshakeTimeout = std::chrono::seconds(
+                    std::max(std::atoi(argv[++i]), 1));
+        }
+        else if (argument == "--idle-seconds" && hasValue) {
+            config.idleTimeout = std::chrono::seconds(
+                    std::max(std::atoi(argv[++i]), 1));
+        }
+        else if (argument == "--outbound-kb" && hasValue) {
+            config.outboundLimit = static_cast<std::size_t>(
+                    std::max(std::atoi(argv[++i]), 1)) << 10;
+        }
+        else if (argument == "--shards" && hasValue) {
+            config.shardCount = std::max(std::atoi(argv[++i]), 1);
+        }
+        else if (argument == "--shard-sockets" && hasValue) {
+            config.shardSockets = argv[++i];
+        }
+        else if (argument == "--snapshot" && hasValue) {
+            config.snapshot = argv[++i];
+        }
+        else if (argument == "--no-snapshot") {
+            config.snapshot.clear();
+        }
+        else if (argument == "--checkpoint-ms" && hasValue) {
+            config.checkpointInterval = std::chrono::milliseconds(
+                    std::max(std::atoi(argv[++i]), 1));
+        }
+        else {
+            std::fprintf(stderr, "unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    //Every connection is a descriptor.
+    rlimit files {};
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+    if (config.shardCount > 1) {
+        if (config.shardSockets.empty()) {
+            config.shardSockets = "/tmp/liars-dice-" + std::to_string(config.port);
+        }
+        if (!threadsGiven) {
+            config.threadCount = std::max<std::size_t>(
+                    config.threadCount / config.shardCount, 1);
+        }
+        //This process only supervises. Every shard is forked before
+        //anything starts a thread and goes down with it; one that dies is
+        //forked again, restores its tables from its own checkpoint, and
+        //the others' links redial it.
+        std::vector<pid_t> shards(config.shardCount, 0);
+        std::vector<std::chrono::steady_clock::time_point> started(
+                config.shardCount);
+        const auto spawn {[&](const unsigned shard) {
+            while (true) {
+                const pid_t child {fork()};
+                if (child == 0) {
+                    prctl(PR_SET_PDEATHSIG, SIGTERM);
+                    config.shardIndex = shard;
+                    return false;
+                }
+                if (child > 0) {
+                    shards[shard] = child;
+                    started[shard] = std::chrono::steady_clock::now();
+                    return true;
+                }
+                std::perror("fork");
+                sleep(1);
+            }
+        }};
+        bool supervising {true};
+        for (unsigned shard {0}; supervising && shard < config.shardCount; ++shard) {
+            supervising = spawn(shard);
+        }
+        while (supervising) {
+            int status {0};
+            const pid_t dead {waitpid(-1, &status, 0)};
+            if (dead < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                std::perror("waitpid");
+                return 1;
+            }
+            const auto found {std::find(shards.begin(), shards.end(), dead)};
+            if (found == shards.end()) {
+                continue;
+            }
+            const unsigned shard {static_cast<unsigned>(found - shards.begin())};
+            std::fprintf(stderr, "shard %u exited (status %d), restarting\n",
+                    shard, status);
+            //One that cannot stay up is retried once a second, not in a
+            //tight loop.
+            if (std::chrono::steady_clock::now() - started[shard]
+                    < std::chrono::seconds(1)) {
+                sleep(1);
+            }
+            supervising = spawn(shard);
+        }
+    }
+
+    Server server {std::move(config)};
     server.startAccepting();
     return 0;
 }
@@ -0,0 +1,289 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/asio.hpp>
+#include "protocol.hpp"
+
+//Shards are server processes sharing one port through SO_REUSEPORT, each
+//with its own tables. A connection the kernel gives to one shard can still
+//sit at a table owned by another: its messages for the table are forwarded
+//over a Unix socket to the owner, which answers the same way.
+namespace Shard {
+    namespace asio = boost::asio;
+
+    //Ids handed out by a shard are congruent to its index, so anyone can
+    //tell which shard owns a table.
+    inline unsigned owner(const std::uint32_t id, const unsigned shardCount) {
+        return id % shardCount;
+    }
+    inline std::string socketPath(
+            const std::string& directory,
+            const unsigned shard) {
+        return directory + "/shard-" + std::to_string(shard) + ".sock";
+    }
+
+    //Precedes each run of protocol messages on a link. stream and
+    //generation name the connection on the shard that has it; the owner
+    //only echoes them back. An empty payload from that shard means the
+    //connection is done with the table; from the owner, that its stand-in
+    //was closed.
+    struct Envelope {
+        std::uint32_t length {0};
+        std::uint64_t stream {0};
+        std::uint32_t generation {0};
+        std::uint32_t playerId {0};
+        std::uint8_t telemetry {0};
+        template <typename Archive> void serialize(Archive& archive) {
+            archive(length, stream, generation, playerId, telemetry);
+        }
+    };
+    constexpr std::size_t envelopeSize {21};
+
+    //One Unix socket between two shards. Writes are batched like a player
+    //stream's: whatever is sent while a write is in flight goes out with
+    //the next one. Both directions are bounded: a payload over maxPayload
+    //fails the link, and send() refuses what would take the queue past
+    //outboundLimit. Everything but construction runs on executor().
+    class Link {
+        public:
+            using OnEnvelope = std::function<void(
+                    const Envelope&, std::span<const std::uint8_t>)>;
+            using OnClosed = std::function<void()>;
+
+        private:
+            asio::strand<asio::io_context::executor_type> strand;
+            asio::local::stream_protocol::socket socket;
+            asio::steady_timer retryTimer;
+            //Set for the connecting side, which redials after a failure.
+            std::string path {};
+            OnEnvelope onEnvelope;
+            OnClosed onClosed;
+            const std::size_t maxPayload;
+            const std::size_t outboundLimit;
+            std::vector<std::uint8_t> outbound {};
+            std::vector<std::uint8_t> writing {};
+            //Received bytes not yet dispatched are [inboundBegin,
+            //inboundEnd); they are moved to the front only when the space
+            //after them runs short.
+            std::vector<std::uint8_t> inbound {};
+            std::size_t inboundBegin {0};
+            std::size_t inboundEnd {0};
+            bool connected {false};
+            bool writingInFlight {false};
+            //Counts connections, so a handler left over from one that
+            //failed does nothing to the next.
+            std::uint64_t session {0};
+
+            static constexpr std::size_t readSize {64 << 10};
+
+            void dial() {
+                socket.async_connect(
+                        asio::local::stream_protocol::endpoint{path},
+                        [this](const boost::system::error_code& error) {
+                            if (error) {
+                                redial();
+                                return;
+                            }
+                            opened();
+                        });
+            }
+            //Peers start in any order, and may restart.
+            void redial() {
+                boost::system::error_code ignored {};
+                socket.close(ignored);
+                retryTimer.expires_after(std::chrono::milliseconds(200));
+                retryTimer.async_wait([this](const boost::system::error_code&) {
+                    dial();
+                });
+            }
+            void opened() {
+                connected = true;
+                ++session;
+                read();
+                flush();
+            }
+            void failed() {
+                if (!connected) {
+                    return;
+                }
+                connected = false;
+                inbound.clear();
+                inboundBegin = 0;
+                inboundEnd = 0;
+                onClosed();
+                //Anything queued was for streams onClosed just gave up on.
+                outbound.clear();
+                if (!path.empty()) {
+                    redial();
+                }
+                else {
+                    boost::system::error_code ignored {};
+                    socket.close(ignored);
+                }
+            }
+
+            void read() {
+                //Compacting once at least half the buffer is consumed
+                //moves each byte a bounded number of times.
+                if (inbound.size() - inboundEnd < readSize
+                 && inboundBegin >= inboundEnd - inboundBegin) {
+                    std::copy(
+                            inbound.begin() + inboundBegin,
+                            inbound.begin() + inboundEnd,
+                            inbound.begin());
+                    inboundEnd -= inboundBegin;
+                    inboundBegin = 0;
+                }
+                if (inbound.size() - inboundEnd < readSize) {
+                    inbound.resize(inboundEnd + readSize);
+                }
+                socket.async_read_some(
+                        asio::buffer(
+                                inbound.data() + inboundEnd,
+                                inbound.size() - inboundEnd),
+                        [this, session {session}](
+                                const boost::system::error_code& error,
+                                const std::size_t transferred) {
+                            if (session != this->session) {
+                                return;
+                            }
+                            if (error) {
+                                failed();
+                                return;
+                            }
+                            inboundEnd += transferred;
+                            if (!dispatch()) {
+                                failed();
+                                return;
+                            }
+                            read();
+                        });
+            }
+            //Hands every complete envelope to onEnvelope; a partial one
+            //waits for the rest. False if the peer announced one bigger
+            //than anything it may send.
+            bool dispatch() {
+                while (inboundEnd - inboundBegin >= envelopeSize) {
+                    const std::span<const std::uint8_t> rest {
+                            inbound.data() + inboundBegin,
+                            inboundEnd - inboundBegin};
+                    Envelope envelope {};
+                    Protocol::Reader reader {rest};
+                    envelope.serialize(reader);
+                    if (envelope.length > maxPayload) {
+                        return false;
+                    }
+                    if (rest.size() - envelopeSize < envelope.length) {
+                        break;
+                    }
+                    onEnvelope(envelope, rest.subspan(
+                            envelopeSize, envelope.length));
+                    inboundBegin += envelopeSize + envelope.length;
+                }
+                return true;
+            }
+
+            void flush() {
+                if (!connected || writingInFlight || outbound.empty()) {
+                    return;
+                }
+                std::swap(outbound, writing);
+                writingInFlight = true;
+                asio::async_write(
+                        socket,
+                        asio::buffer(writing),
+                        [this, session {session}](
+                                const boost::system::error_code& error,
+                                std::size_t) {
+                            writingInFlight = false;
+                            writing.clear();
+                            if (error && session == this->session) {
+                                failed();
+                                return;
+                            }
+                            flush();
+                        });
+            }
+
+        public:
+            Link(asio::io_context& ioContext,
+                    const std::size_t maxPayload,
+                    const std::size_t outboundLimit,
+                    OnEnvelope onEnvelope,
+                    OnClosed onClosed)
+                  : strand {asio::make_strand(ioContext)},
+                    socket {strand},
+                    retryTimer {strand},
+                    onEnvelope {std::move(onEnvelope)},
+                    onClosed {std::move(onClosed)},
+                    maxPayload {maxPayload},
+                    outboundLimit {outboundLimit} {}
+            Link(const Link&) = delete;
+            Link& operator=(const Link&) = delete;
+
+            asio::any_io_executor executor() const {
+                return strand;
+            }
+
+            //Keeps dialing path until the peer answers.
+            void connect(std::string path) {
+                this->path = std::move(path);
+                asio::post(strand, [this] {
+                    dial();
+                });
+            }
+            //Takes the next connection on acceptor, then calls accepted
+            //with whether there was one. An accepted link that has closed
+            //may accept again.
+            void accept(
+                    asio::local::stream_protocol::acceptor& acceptor,
+                    std::function<void(bool)> accepted) {
+                acceptor.async_accept(socket, [this, accepted {
+                        std::move(accepted)}]
+                        (const boost::system::error_code& error) {
+                    if (!error) {
+                        asio::post(strand, [this] {
+                            opened();
+                        });
+                    }
+                    accepted(!error);
+                });
+            }
+
+            //Queues one envelope holding buffers back to back. Sent once
+            //connected; dropped if the link fails first. False, and nothing
+            //queued, if the peer is too far behind or the payload is too
+            //big for it to accept; empty envelopes always go.
+            bool send(
+                    Envelope envelope,
+                    const std::span<const asio::const_buffer> buffers) {
+                envelope.length = 0;
+                for (const asio::const_buffer& buffer : buffers) {
+                    envelope.length += static_cast<std::uint32_t>(buffer.size());
+                }
+                if (envelope.length != 0 && (envelope.length > maxPayload
+                 || outbound.size() + envelopeSize + envelope.length
+                        > outboundLimit)) {
+                    return false;
+                }
+                Protocol::Writer writer {outbound};
+                envelope.serialize(writer);
+                for (const asio::const_buffer& buffer : buffers) {
+                    const auto* bytes {
+                            static_cast<const std::uint8_t*>(buffer.data())};
+                    outbound.insert(
+                            outbound.end(), bytes, bytes + buffer.size());
+                }
+                flush();
+                return true;
+            }
+    };
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//Fixed-address object pool. Objects are allocated in chunks that are never
+//moved or freed while the slab lives, and released objects are kept on a
+//free list and handed out again as-is, so any resources they own (buffers)
+//are reused instead of reallocated.
+template <typename T, std::size_t chunkSize = 256>
+class Slab {
+    private:
+        struct Slot {
+            T value {};
+            Slot* nextFree {nullptr};
+        };
+
+        std::mutex mutex {};
+        std::vector<std::unique_ptr<Slot[]>> chunks {};
+        Slot* freeList {nullptr};
+        std::size_t liveCount {0};
+
+        void grow() {
+            chunks.push_back(std::make_unique<Slot[]>(chunkSize));
+            Slot* chunk {chunks.back().get()};
+            for (std::size_t i {0}; i < chunkSize; ++i) {
+                chunk[i].nextFree = freeList;
+                freeList = &chunk[i];
+            }
+        }
+
+    public:
+        Slab() = default;
+        Slab(const Slab&) = delete;
+        Slab& operator=(const Slab&) = delete;
+
+        T& acquire() {
+            std::lock_guard lock {mutex};
+            if (freeList == nullptr) {
+                grow();
+            }
+            Slot* slot {freeList};
+            freeList = slot->nextFree;
+            slot->nextFree = nullptr;
+            ++liveCount;
+            return slot->value;
+        }
+        //value must have come from acquire() on this slab. The caller is
+        //responsible for resetting whatever should not outlive a use.
+        void release(T& value) {
+            //value is the first member of Slot
+            Slot* slot {reinterpret_cast<Slot*>(&value)};
+            std::lock_guard lock {mutex};
+            slot->nextFree = freeList;
+            freeList = slot;
+            --liveCount;
+        }
+
+        std::size_t size() {
+            std::lock_guard lock {mutex};
+            return liveCount;
+        }
+        std::size_t capacity() {
+            std::lock_guard lock {mutex};
+            return chunks.size() * chunkSize;
+        }
+};
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+//Live state checkpointed into a memory-mapped file, so a restarted process
+//picks up where the last one stopped.
+namespace Snapshot {
+    constexpr unsigned noSlot {~0u};
+
+    //FNV-1a
+    inline std::uint64_t checksum(const void* data, const std::size_t size) {
+        const auto* bytes {static_cast<const std::uint8_t*>(data)};
+        std::uint64_t hash {0xCBF29CE484222325ull};
+        for (std::size_t i {0}; i < size; ++i) {
+            hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+        }
+        return hash;
+    }
+
+    //A fixed number of slots of one trivially copyable record each. Every
+    //slot holds two copies written alternately, so the one not being
+    //written is always whole: a process that dies mid-write loses that
+    //write and nothing older. Writing a slot is a memcpy into the page
+    //cache; the kernel gets the pages to disk on its own, and flush() only
+    //nudges it.
+    template <typename Record>
+    class File {
+        static_assert(std::is_trivially_copyable_v<Record>);
+
+        private:
+            static constexpr std::uint32_t magic {0x3253444C}; //"LDS2"
+
+            struct Header {
+                std::uint32_t magic;
+                std::uint32_t recordSize;
+                std::uint64_t slotCount;
+                std::uint64_t counter;
+            };
+            struct Copy {
+                std::uint64_t sequence;
+                std::uint64_t check;
+                Record record;
+            };
+            struct Slot {
+                Copy copies[2];
+            };
+
+            void* mapping {MAP_FAILED};
+            std::size_t mappingSize {0};
+            Header* header {nullptr};
+            Slot* slots {nullptr};
+            std::size_t slotCount {0};
+
+            std::mutex mutex {};
+            std::vector<unsigned> freeSlots {};
+
+            static std::uint64_t checkOf(const Copy& copy) {
+                return checksum(&copy.sequence, sizeof(copy.sequence))
+                     ^ checksum(&copy.record, sizeof(copy.record));
+            }
+            //The newer whole copy in slot, if any.
+            const Copy* latest(const Slot& slot) const {
+                const Copy* best {nullptr};
+                for (const Copy& copy : slot.copies) {
+                    if (copy.sequence != 0 && copy.check == checkOf(copy)
+                     && (best == nullptr || copy.sequence > best->sequence)) {
+                        best = &copy;
+                    }
+                }
+                return best;
+            }
+
+        public:
+            //Without a path, or with a file that cannot be opened, every
+            //slot is unavailable; a file laid out for another record is
+            //started over.
+            File(const std::string& path, const std::size_t slotCount) {
+                if (path.empty() || slotCount == 0) {
+                    return;
+                }
+                const int descriptor {::open(path.c_str(), O_RDWR | O_CREAT, 0644)};
+                if (descriptor < 0) {
+                    std::perror(path.c_str());
+                    return;
+                }
+                const std::size_t size {sizeof(Header) + slotCount * sizeof(Slot)};
+                if (::ftruncate(descriptor, static_cast<off_t>(size)) == 0) {
+                    mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, descriptor, 0);
+                }
+                ::close(descriptor);
+                if (mapping == MAP_FAILED) {
+                    std::perror(path.c_str());
+                    return;
+                }
+                mappingSize = size;
+                header = static_cast<Header*>(mapping);
+                slots = reinterpret_cast<Slot*>(header + 1);
+                this->slotCount = slotCount;
+                if (header->magic != magic
+                 || header->recordSize != sizeof(Record)
+                 || header->slotCount != slotCount) {
+                    std::memset(mapping, 0, size);
+                    *header = {
+                            .magic = magic,
+                            .recordSize = sizeof(Record),
+                            .slotCount = slotCount,
+                            .counter = 0};
+                }
+            }
+            File(const File&) = delete;
+            File& operator=(const File&) = delete;
+            ~File() {
+                if (mapping != MAP_FAILED) {
+                    ::msync(mapping, mappingSize, MS_SYNC);
+                    ::munmap(mapping, mappingSize);
+                }
+            }
+
+            //Once, before anything is acquired: calls visit(slot, sequence,
+            //record) for every slot with a record, and frees the rest.
+            template <typename Visit>
+            void restore(Visit&& visit) {
+                std::lock_guard lock {mutex};
+                freeSlots.clear();
+                for (std::size_t slot {slotCount}; slot-- > 0;) {
+                    if (const Copy* copy {latest(slots[slot])}) {
+                        visit(static_cast<unsigned>(slot),
+                                copy->sequence, copy->record);
+                    }
+                    else {
+                        std::memset(static_cast<void*>(&slots[slot]),
+                                0, sizeof(Slot));
+                        freeSlots.push_back(static_cast<unsigned>(slot));
+                    }
+                }
+            }
+
+            //noSlot once full.
+            unsigned acquire() {
+                std::lock_guard lock {mutex};
+                if (freeSlots.empty()) {
+                    return noSlot;
+                }
+                const unsigned slot {freeSlots.back()};
+                freeSlots.pop_back();
+                return slot;
+            }
+            void release(const unsigned slot) {
+                std::memset(static_cast<void*>(&slots[slot]), 0, sizeof(Slot));
+                std::lock_guard lock {mutex};
+                freeSlots.push_back(slot);
+            }
+
+            //One writer per slot at a time; sequence must grow with every
+            //write to it.
+            void write(
+                    const unsigned slot,
+                    const std::uint64_t sequence,
+                    const Record& record) {
+                Copy& copy {slots[slot].copies[sequence & 1]};
+                copy.sequence = sequence;
+                std::memcpy(&copy.record, &record, sizeof(Record));
+                copy.check = checkOf(copy);
+            }
+
+            //A number kept beside the records for the owner; 0 in a new file.
+            std::uint64_t counter() const {
+                return header != nullptr ? header->counter : 0;
+            }
+            //One writer at a time, like the slots.
+            void setCounter(const std::uint64_t value) {
+                if (header != nullptr) {
+                    header->counter = value;
+                }
+            }
+
+            //Starts writeback without waiting for it.
+            void flush() {
+                if (mapping != MAP_FAILED) {
+                    ::msync(mapping, mappingSize, MS_ASYNC);
+                }
+            }
+    };
+}
@@ -0,0 +1,318 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "game.hpp"
+#include "strategy.hpp"
+
+//Offline heads-up solver. Runs external-sampling Monte Carlo CFR over
+//every pairing of 1..maxDice dice against 1..maxDice dice and writes the
+//average strategy in the format strategy.hpp maps.
+//
+//    solver [--max-dice N] [--wild-ones] [--iterations N] [--threads N]
+//           [--output PATH]
+class Solver {
+    private:
+        static constexpr unsigned maxSlots {
+                Strategy::ladderSize(Game::startingDice, Game::startingDice) + 1};
+
+        //xorshift64*
+        struct Random {
+            std::uint64_t state;
+
+            std::uint64_t next() {
+                state ^= state >> 12;
+                state ^= state << 25;
+                state ^= state >> 27;
+                return state * 0x2545F4914F6CDD1Dull;
+            }
+            unsigned below(const unsigned bound) {
+                return static_cast<unsigned>(((next() >> 32) * bound) >> 32);
+            }
+            float unit() {
+                return static_cast<float>(next() >> 40) / (1 << 24);
+            }
+        };
+
+        struct Deal {
+            std::array<unsigned, 2> dice {};
+            std::array<Game::Hand, 2> hands {};
+            std::array<unsigned, 2> handRanks {};
+            Game::Hand total {0};
+        };
+
+        const unsigned maxDice;
+        const std::uint8_t rules;
+        const Strategy::Layout layout;
+        //Every thread adds into the same tables; float fetch_add keeps that
+        //lock-free, and nothing ever needs a consistent snapshot mid-run.
+        std::vector<std::atomic<float>> regrets;
+        std::vector<std::atomic<float>> strategySums;
+
+        Deal deal(Random& random) const {
+            Deal result {};
+            for (unsigned player {0}; player < 2; ++player) {
+                result.dice[player] = 1 + random.below(maxDice);
+                for (unsigned die {0}; die < result.dice[player]; ++die) {
+                    result.hands[player] += Game::Hand{1}
+                          << (Game::laneBits * random.below(Game::faceCount));
+                }
+                result.handRanks[player] = Strategy::handRank(
+                        result.hands[player], result.dice[player]);
+                result.total += result.hands[player];
+            }
+            return result;
+        }
+
+        //Regret matching over the legal slots of one information set.
+        void currentStrategy(
+                const std::uint64_t base,
+                const unsigned lastBid,
+                const unsigned slotCount,
+                std::array<float, maxSlots>& strategy) const {
+            float positive {0};
+            for (unsigned slot {0}; slot < slotCount; ++slot) {
+                const bool legal {slot == 0 ? lastBid != 0 : slot > lastBid};
+                strategy[slot] = legal
+                      ? std::max(regrets[base + slot].load(
+                                std::memory_order_relaxed), 0.0f)
+                      : 0;
+                positive += strategy[slot];
+            }
+            const unsigned legalCount {
+                    slotCount - 1 - lastBid + (lastBid != 0)};
+            for (unsigned slot {0}; slot < slotCount; ++slot) {
+                const bool legal {slot == 0 ? lastBid != 0 : slot > lastBid};
+                strategy[slot] = positive > 0
+                      ? strategy[slot] / positive
+                      : legal / static_cast<float>(legalCount);
+            }
+        }
+
+        //Utility for traverser of the subgame where actor is about to act.
+        float traverse(
+                const Deal& deal,
+                const unsigned actor,
+                const unsigned lastBid,
+                const unsigned traverser,
+                Random& random) {
+            const unsigned other {1 - actor};
+            const unsigned slotCount {Strategy::ladderSize(
+                    deal.dice[actor], deal.dice[other]) + 1};
+            const std::uint64_t base {layout.index(
+                    deal.dice[actor],
+                    deal.dice[other],
+                    deal.handRanks[actor],
+                    lastBid)};
+            std::array<float, maxSlots> strategy;
+            currentStrategy(base, lastBid, slotCount, strategy);
+
+            const auto outcome {[&](const unsigned slot) -> float {
+                if (slot != 0) {
+                    return traverse(deal, other, slot, traverser, random);
+                }
+                //actor challenges other's bid
+                const unsigned count {(lastBid - 1) / Game::faceCount + 1};
+                const unsigned face {(lastBid - 1) % Game::faceCount + 1};
+                const bool bidHolds {
+                        Game::matching(deal.total, face, rules) >= count};
+                const unsigned winner {bidHolds ? other : actor};
+                return winner == traverser ? 1.0f : -1.0f;
+            }};
+
+            if (actor == traverser) {
+                std::array<float, maxSlots> utilities;
+                float expected {0};
+                for (unsigned slot {0}; slot < slotCount; ++slot) {
+                    if (slot == 0 ? lastBid != 0 : slot > lastBid) {
+                        utilities[slot] = outcome(slot);
+                        expected += strategy[slot] * utilities[slot];
+                    }
+                }
+                for (unsigned slot {0}; slot < slotCount; ++slot) {
+                    if (slot == 0 ? lastBid != 0 : slot > lastBid) {
+                        regrets[base + slot].fetch_add(
+                                utilities[slot] - expected,
+                                std::memory_order_relaxed);
+                    }
+                }
+                return expected;
+            }
+
+            float target {random.unit()};
+            unsigned sampled {0};
+            for (unsigned slot {0}; slot < slotCount; ++slot) {
+                if (strategy[slot] > 0) {
+                    strategySums[base + slot].fetch_add(
+                            strategy[slot], std::memory_order_relaxed);
+                }
+            }
+            for (unsigned slot {0}; slot < slotCount; ++slot) {
+                if (strategy[slot] > 0) {
+                    //Ends on the last legal slot if rounding runs target out.
+                    sampled = slot;
+                    if (target < strategy[slot]) {
+                        break;
+                    }
+                    target -= strategy[slot];
+                }
+            }
+            return outcome(sampled);
+        }
+
+    public:
+        Solver(const unsigned maxDice, const std::uint8_t rules)
+              : maxDice {maxDice},
+                rules {rules},
+                layout {maxDice},
+                regrets(layout.slotCount()),
+                strategySums(layout.slotCount()) {}
+
+        std::uint64_t slotCount() const {
+            return layout.slotCount();
+        }
+
+        //Iterations are handed out in small chunks from a shared counter,
+        //so fast threads keep pulling work until the budget is spent.
+        void run(const std::uint64_t iterations, const unsigned threadCount) {
+            constexpr std::uint64_t chunkSize {64};
+            std::atomic<std::uint64_t> nextIteration {0};
+            std::atomic<std::uint64_t> reported {0};
+            const std::uint64_t seed {std::random_device{}()};
+            std::vector<std::thread> workers;
+            for (unsigned thread {0}; thread < threadCount; ++thread) {
+                workers.emplace_back([&, thread] {
+                    Random random {
+                            (seed + thread + 1) * 0x9E3779B97F4A7C15ull | 1};
+                    while (true) {
+                        const std::uint64_t first {nextIteration.fetch_add(
+                                chunkSize, std::memory_order_relaxed)};
+                        if (first >= iterations) {
+                            return;
+                        }
+                        const std::uint64_t last {
+                                std::min(first + chunkSize, iterations)};
+                        for (std::uint64_t i {first}; i < last; ++i) {
+                            const Deal dealt {deal(random)};
+                            traverse(dealt, 0, 0, i & 1, random);
+                        }
+                        if (thread == 0
+                         && last - reported.load() >= iterations / 100) {
+                            reported = last;
+                            std::printf(
+                                    "%llu / %llu iterations\n",
+                                    static_cast<unsigned long long>(last),
+                                    static_cast<unsigned long long>(iterations));
+                        }
+                    }
+                });
+            }
+            for (auto& worker : workers) {
+                worker.join();
+            }
+        }
+
+        //Normalizes the average strategy of every information set to bytes.
+        bool write(const std::string& path) const {
+            std::vector<std::uint8_t> slots(layout.slotCount(), 0);
+            for (unsigned dice {1}; dice <= maxDice; ++dice) {
+                for (unsigned otherDice {1}; otherDice <= maxDice; ++otherDice) {
+                    const unsigned slotCount {
+                            Strategy::ladderSize(dice, otherDice) + 1};
+                    for (unsigned hand {0};
+                            hand < Strategy::handCount(dice);
+                            ++hand) {
+                        for (unsigned lastBid {0}; lastBid < slotCount; ++lastBid) {
+                            const std::uint64_t base {
+                                    layout.index(dice, otherDice, hand, lastBid)};
+                            float total {0};
+                            for (unsigned slot {0}; slot < slotCount; ++slot) {
+                                total += strategySums[base + slot].load();
+                            }
+                            if (total <= 0) {
+                                continue;
+                            }
+                            for (unsigned slot {0}; slot < slotCount; ++slot) {
+                                slots[base + slot] = static_cast<std::uint8_t>(
+                                        255 * strategySums[base + slot].load()
+                                      / total + 0.5f);
+                            }
+                        }
+                    }
+                }
+            }
+
+            const Strategy::Header header {
+                    .maxDice = maxDice,
+                    .rules = rules,
+                    .slotCount = layout.slotCount()};
+            const std::string temporary {path + ".tmp"};
+            std::FILE* file {std::fopen(temporary.c_str(), "wb")};
+            if (file == nullptr) {
+                return false;
+            }
+            const bool written {
+                    std::fwrite(&header, sizeof(header), 1, file) == 1
+                 && std::fwrite(slots.data(), 1, slots.size(), file)
+                  == slots.size()};
+            if (std::fclose(file) != 0 || !written) {
+                std::remove(temporary.c_str());
+                return false;
+            }
+            //Servers mapping the old file keep their mapping.
+            return std::rename(temporary.c_str(), path.c_str()) == 0;
+        }
+};
+
+int main(int argc, char* argv[]) {
+    unsigned maxDice {2};
+    std::uint8_t rules {Game::Rules::STANDARD};
+    std::uint64_t iterations {1000000};
+    unsigned threadCount {std::max(std::thread::hardware_concurrency(), 1u)};
+    std::string output {"assets/strategy.bin"};
+    for (int i {1}; i < argc; ++i) {
+        const std::string argument {argv[i]};
+        const bool hasValue {i + 1 < argc};
+        if (argument == "--max-dice" && hasValue) {
+            maxDice = std::clamp(std::atoi(argv[++i]), 1,
+                    static_cast<int>(Game::startingDice));
+        }
+        else if (argument == "--wild-ones") {
+            rules |= Game::Rules::WILD_ONES;
+        }
+        else if (argument == "--iterations" && hasValue) {
+            iterations = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (argument == "--threads" && hasValue) {
+            threadCount = std::max(std::atoi(argv[++i]), 1);
+        }
+        else if (argument == "--output" && hasValue) {
+            output = argv[++i];
+        }
+        else {
+            std::fprintf(stderr, "unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    Solver solver {maxDice, rules};
+    std::printf(
+            "solving up to %u dice each, %llu slots, %u threads\n",
+            maxDice,
+            static_cast<unsigned long long>(solver.slotCount()),
+            threadCount);
+    solver.run(iterations, threadCount);
+    if (!solver.write(output)) {
+        std::fprintf(stderr, "could not write %s\n", output.c_str());
+        return 1;
+    }
+    std::printf("wrote %s\n", output.c_str());
+    return 0;
+}
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "game.hpp"
+#include "probability.hpp"
+
+//Heads-up strategy tables written by the solver and read by the server.
+//
+//An information set is (own dice, opponent dice, own hand, last bid); the
+//bid history before the last bid is forgotten, which keeps the table small.
+//Each information set stores one byte per action slot: slot 0 is
+//"challenge", slot i is the i-th bid on the ladder (1 x 1, 1 x 2, ...,
+//1 x 6, 2 x 1, ...). The bytes of the legal actions sum to about 255.
+//
+//The file is a Header followed directly by the slots in Layout order, so
+//the server maps it read-only and indexes into it with no parsing; every
+//process mapping the same file shares the same physical pages.
+namespace Strategy {
+    constexpr std::array<char, 8> magic {'L', 'D', 'S', 'T', 'R', 'A', 'T', '1'};
+    constexpr std::uint32_t formatVersion {1};
+
+    struct Header {
+        std::array<char, 8> magic {Strategy::magic};
+        std::uint32_t version {formatVersion};
+        std::uint32_t maxDice {0};
+        std::uint32_t rules {0};
+        std::uint32_t reserved {0};
+        std::uint64_t slotCount {0};
+    };
+
+    constexpr std::uint64_t choose(const unsigned n, const unsigned k) {
+        std::uint64_t result {1};
+        for (unsigned i {1}; i <= k; ++i) {
+            result = result * (n - k + i) / i;
+        }
+        return result;
+    }
+    //Distinct hands of dice dice, ignoring order.
+    constexpr unsigned handCount(const unsigned dice) {
+        return static_cast<unsigned>(
+                choose(dice + Game::faceCount - 1, Game::faceCount - 1));
+    }
+    //Position of hand among all hands of the same size, ordered by the count
+    //of ones, then twos, and so on. Dense in [0, handCount(dice)).
+    constexpr unsigned handRank(const Game::Hand hand, const unsigned dice) {
+        unsigned rank {0};
+        unsigned remaining {dice};
+        for (unsigned face {1}; face < Game::faceCount; ++face) {
+            const unsigned count {Game::faceCountOf(hand, face)};
+            const unsigned facesAfter {Game::faceCount - face};
+            for (unsigned smaller {0}; smaller < count; ++smaller) {
+                rank += static_cast<unsigned>(choose(
+                        remaining - smaller + facesAfter - 1,
+                        facesAfter - 1));
+            }
+            remaining -= count;
+        }
+        return rank;
+    }
+
+    constexpr unsigned ladderSize(const unsigned dice, const unsigned otherDice) {
+        return Game::faceCount * (dice + otherDice);
+    }
+    constexpr unsigned ladderIndex(const unsigned count, const unsigned face) {
+        return Game::bidRank(count, face) - Game::faceCount;
+    }
+
+    class Layout {
+        private:
+            unsigned maxDice {0};
+            std::array<std::uint64_t,
+                    Game::startingDice * Game::startingDice + 1> offsets {};
+
+        public:
+            Layout() = default;
+            explicit Layout(const unsigned maxDice) : maxDice {maxDice} {
+                std::uint64_t offset {0};
+                for (unsigned dice {1}; dice <= maxDice; ++dice) {
+                    for (unsigned otherDice {1}; otherDice <= maxDice; ++otherDice) {
+                        offsets[block(dice, otherDice)] = offset;
+                        const std::uint64_t slots {
+                                ladderSize(dice, otherDice) + 1u};
+                        offset += handCount(dice) * slots * slots;
+                    }
+                }
+                offsets[maxDice * maxDice] = offset;
+            }
+
+            unsigned block(const unsigned dice, const unsigned otherDice) const {
+                return (dice - 1) * maxDice + (otherDice - 1);
+            }
+            bool covers(const unsigned dice, const unsigned otherDice) const {
+                return dice >= 1 && dice <= maxDice
+                    && otherDice >= 1 && otherDice <= maxDice;
+            }
+            std::uint64_t slotCount() const {
+                return offsets[maxDice * maxDice];
+            }
+            //First of the ladderSize() + 1 action slots of an information set.
+            //lastBid is 0 before any bid, else ladderIndex() + 1.
+            std::uint64_t index(
+                    const unsigned dice,
+                    const unsigned otherDice,
+                    const unsigned handRank,
+                    const unsigned lastBid) const {
+                const std::uint64_t slots {ladderSize(dice, otherDice) + 1u};
+                return offsets[block(dice, otherDice)]
+                     + (handRank * slots + lastBid) * slots;
+            }
+    };
+
+    //A read-only mapping of a solved strategy file.
+    class Table {
+        private:
+            const std::uint8_t* mapping {nullptr};
+            std::size_t mappingSize {0};
+            Header header {};
+            Layout layout {};
+
+        public:
+            Table() = default;
+            Table(const Table&) = delete;
+            Table& operator=(const Table&) = delete;
+            ~Table() {
+                if (mapping != nullptr) {
+                    munmap(const_cast<std::uint8_t*>(mapping), mappingSize);
+                }
+            }
+
+            //Returns false (and stays empty) if path is missing or is not a
+            //strategy file this build understands.
+            bool open(const char* path) {
+                const int file {::open(path, O_RDONLY | O_CLOEXEC)};
+                if (file < 0) {
+                    return false;
+                }
+                struct stat status {};
+                if (fstat(file, &status) != 0
+                 || static_cast<std::size_t>(status.st_size) < sizeof(Header)) {
+                    close(file);
+                    return false;
+                }
+                void* mapped {mmap(
+                        nullptr,
+                        status.st_size,
+                        PROT_READ,
+                        MAP_SHARED,
+                        file,
+                        0)};
+                close(file);
+                if (mapped == MAP_FAILED) {
+                    return false;
+                }
+                Header read {};
+                std::memcpy(&read, mapped, sizeof(Header));
+                //Layout sizes its offsets for startingDice, so the header is
+                //checked before one is built from it.
+                if (read.magic != magic
+                 || read.version != formatVersion
+                 || read.maxDice < 1
+                 || read.maxDice > Game::startingDice) {
+                    munmap(mapped, status.st_size);
+                    return false;
+                }
+                const Layout readLayout {read.maxDice};
+                if (read.slotCount != readLayout.slotCount()
+                 || sizeof(Header) + read.slotCount
+                  > static_cast<std::size_t>(status.st_size)) {
+                    munmap(mapped, status.st_size);
+                    return false;
+                }
+                header = read;
+                layout = readLayout;
+                mapping = static_cast<const std::uint8_t*>(mapped);
+                mappingSize = status.st_size;
+                return true;
+            }
+
+            bool loaded() const {
+                return mapping != nullptr;
+            }
+            bool covers(
+                    const unsigned dice,
+                    const unsigned otherDice,
+                    const std::uint8_t rules) const {
+                return loaded() && header.rules == rules
+                    && layout.covers(dice, otherDice);
+            }
+
+            //Samples a move; random is any uniformly distributed 32 bits.
+            //Returns nothing if the table does not cover this situation.
+            std::optional<Probability::Move> choose(
+                    const unsigned dice,
+                    const unsigned otherDice,
+                    const std::uint8_t rules,
+                    const Game::Hand hand,
+                    const unsigned bidCount,
+                    const unsigned bidFace,
+                    const std::uint32_t random) const {
+                if (!covers(dice, otherDice, rules)) {
+                    return std::nullopt;
+                }
+                const unsigned lastBid {
+                        bidCount == 0 ? 0 : ladderIndex(bidCount, bidFace) + 1};
+                const std::uint8_t* slots {
+                        mapping + sizeof(Header) + layout.index(
+                                dice,
+                                otherDice,
+                                handRank(hand, dice),
+                                lastBid)};
+                const unsigned slotCount {ladderSize(dice, otherDice) + 1};
+                //Legal actions are challenge (once there is a bid) and every
+                //bid above the last one.
+                unsigned total {lastBid != 0 ? slots[0] : 0u};
+                for (unsigned slot {lastBid + 1}; slot < slotCount; ++slot) {
+                    total += slots[slot];
+                }
+                if (total == 0) {
+                    return std::nullopt;
+                }
+                unsigned target {static_cast<unsigned>(
+                        (static_cast<std::uint64_t>(random) * total) >> 32)};
+                if (lastBid != 0) {
+                    if (target < slots[0]) {
+                        return Probability::Move{.challenge = true};
+                    }
+                    target -= slots[0];
+                }
+                for (unsigned slot {lastBid + 1}; slot < slotCount; ++slot) {
+                    if (target < slots[slot]) {
+                        return Probability::Move{
+                                .count = static_cast<std::uint8_t>(
+                                        (slot - 1) / Game::faceCount + 1),
+                                .face = static_cast<std::uint8_t>(
+                                        (slot - 1) % Game::faceCount + 1)};
+                    }
+                    target -= slots[slot];
+                }
+                return std::nullopt;
+            }
+    };
+}
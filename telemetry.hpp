@@ -0,0 +1,236 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "debug.hpp"
+#include "ring.hpp"
+
+//Gameplay capture for players who opt in.
+//
+//Producers (io threads) push fixed-size records into a bounded lock-free
+//queue and never wait: if the writer falls behind, records are dropped and
+//counted in stats. A background thread, started with the first record so
+//a server nobody opts in to never creates the directory, drains the queue
+//in batches and appends them to segment files as compressed blocks. Each
+//block is
+//    u32 magic, u32 record count, u32 payload size, u64 first timestamp
+//followed by the payload: per record, the zigzagged time delta from the
+//previous record and the ids and hand as LEB128 varints, then the four
+//single-byte fields as they are.
+namespace Telemetry {
+    enum class Kind : std::uint8_t {
+        BID = 1,
+        CHALLENGE,
+        OUTCOME,
+    };
+
+    struct Record {
+        //microseconds since the epoch
+        std::uint64_t time {0};
+        std::uint32_t tableId {0};
+        std::uint32_t playerId {0};
+        //the acting player's hand, packed as in game.hpp
+        std::uint32_t hand {0};
+        Kind kind {Kind::BID};
+        std::uint8_t seat {0};
+        //BID: count, face. CHALLENGE: the bid's count, face.
+        //OUTCOME: actual count, challenger (seat is the loser).
+        std::uint8_t a {0};
+        std::uint8_t b {0};
+    };
+
+    inline std::uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    class Log {
+        private:
+            static constexpr std::uint32_t blockMagic {0x4C445442}; //"LDTB"
+            static constexpr std::size_t blockRecords {4096};
+            static constexpr std::uintmax_t segmentBytes {64 << 20};
+            //The ring holds about this long of records at 600k a second.
+            static constexpr std::chrono::milliseconds drainInterval {100};
+
+            const std::filesystem::path directory;
+            Ring<Record, 1 << 16> ring {};
+            Debug::Counter dropped {"telemetry dropped"};
+            std::once_flag started {};
+            std::mutex mutex {};
+            std::condition_variable wake {};
+            bool running {true};
+            //Set by a producer that found the ring full, cleared by the
+            //writer as it starts draining.
+            std::atomic<bool> behind {false};
+            std::thread writer;
+
+            std::FILE* segment {nullptr};
+            std::uintmax_t segmentSize {0};
+            std::vector<Record> batch {};
+            std::vector<std::uint8_t> block {};
+
+            static void putVarint(
+                    std::vector<std::uint8_t>& out, std::uint64_t value) {
+                while (value >= 0x80) {
+                    out.push_back(static_cast<std::uint8_t>(value | 0x80));
+                    value >>= 7;
+                }
+                out.push_back(static_cast<std::uint8_t>(value));
+            }
+            template <typename Integer>
+            static void putFixed(
+                    std::vector<std::uint8_t>& out, const Integer value) {
+                for (std::size_t i {0}; i < sizeof(Integer); ++i) {
+                    out.push_back(static_cast<std::uint8_t>(value >> (8 * i)));
+                }
+            }
+
+            void openSegment() {
+                if (segment != nullptr) {
+                    std::fclose(segment);
+                }
+                const std::filesystem::path path {directory / (
+                        "segment-" + std::to_string(now()) + ".ldt")};
+                segment = std::fopen(path.c_str(), "ab");
+                segmentSize = 0;
+            }
+
+            void writeBatch() {
+                if (batch.empty()) {
+                    return;
+                }
+                block.clear();
+                putFixed(block, blockMagic);
+                putFixed(block, static_cast<std::uint32_t>(batch.size()));
+                putFixed(block, std::uint32_t{0});
+                putFixed(block, batch.front().time);
+                std::uint64_t previous {batch.front().time};
+                for (const Record& record : batch) {
+                    //Records arrive from several threads, so time can step
+                    //back slightly; zigzag keeps small negatives small.
+                    const auto delta {static_cast<std::int64_t>(
+                            record.time - previous)};
+                    putVarint(block, static_cast<std::uint64_t>(
+                            (delta << 1) ^ (delta >> 63)));
+                    previous = record.time;
+                    putVarint(block, record.tableId);
+                    putVarint(block, record.playerId);
+                    putVarint(block, record.hand);
+                    block.push_back(static_cast<std::uint8_t>(record.kind));
+                    block.push_back(record.seat);
+                    block.push_back(record.a);
+                    block.push_back(record.b);
+                }
+                const auto payloadSize {
+                        static_cast<std::uint32_t>(block.size() - 20)};
+                for (std::size_t i {0}; i < 4; ++i) {
+                    block[8 + i] = static_cast<std::uint8_t>(
+                            payloadSize >> (8 * i));
+                }
+                batch.clear();
+
+                if (segment == nullptr || segmentSize >= segmentBytes) {
+                    openSegment();
+                }
+                if (segment == nullptr) {
+                    return;
+                }
+                std::fwrite(block.data(), 1, block.size(), segment);
+                std::fflush(segment);
+                segmentSize += block.size();
+            }
+
+            void start() {
+                std::error_code ignored {};
+                std::filesystem::create_directories(directory, ignored);
+                writer = std::thread{&Log::writerLoop, this};
+            }
+
+            //Drains every drainInterval, sooner when a producer finds the
+            //queue full, and once more when stopped.
+            void writerLoop() {
+                batch.reserve(blockRecords);
+                while (true) {
+                    //Read before draining so nothing pushed before stop() is
+                    //left behind.
+                    bool stopping {false};
+                    {
+                        std::unique_lock lock {mutex};
+                        wake.wait_for(lock, drainInterval, [this] {
+                            return !running || behind.load();
+                        });
+                        stopping = !running;
+                    }
+                    behind.store(false);
+                    Record record;
+                    while (ring.pop(record)) {
+                        batch.push_back(record);
+                        if (batch.size() == blockRecords) {
+                            writeBatch();
+                        }
+                    }
+                    writeBatch();
+                    if (stopping) {
+                        break;
+                    }
+                }
+                if (segment != nullptr) {
+                    std::fclose(segment);
+                    segment = nullptr;
+                }
+            }
+
+        public:
+            explicit Log(std::filesystem::path directory)
+                  : directory {std::move(directory)} {}
+            Log(const Log&) = delete;
+            Log& operator=(const Log&) = delete;
+            ~Log() {
+                stop();
+            }
+
+            void stop() {
+                {
+                    const std::lock_guard lock {mutex};
+                    running = false;
+                }
+                wake.notify_one();
+                if (writer.joinable()) {
+                    writer.join();
+                }
+            }
+
+            //Never waits for the writer; drops the record if it is behind,
+            //and wakes it. Only the first drop since the writer last woke
+            //takes the mutex, so the wakeup cannot slip in between its
+            //check and its wait.
+            void record(Record record) {
+                std::call_once(started, &Log::start, this);
+                record.time = now();
+                if (!ring.push(record)) {
+                    dropped.add();
+                    if (!behind.exchange(true)) {
+                        {
+                            const std::lock_guard lock {mutex};
+                        }
+                        wake.notify_one();
+                    }
+                }
+            }
+
+            std::uint64_t droppedCount() const {
+                return static_cast<std::uint64_t>(dropped.get());
+            }
+    };
+}
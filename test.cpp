@@ -0,0 +1,133 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include "game.hpp"
+#include "strategy.hpp"
+
+//Regression tests for the game rules and the files the server loads.
+//
+//    test [FILTER]
+//
+//Runs each test whose name contains FILTER (all by default), prints the
+//ones that fail, and exits non-zero if any did.
+namespace {
+    struct Test {
+        const char* name;
+        //Returns what went wrong, or nullptr.
+        const char* (*run)();
+    };
+
+    //A started game with seats players; seat 0 opens.
+    Game::Table startedTable(const unsigned seats) {
+        Game::Table table {1, static_cast<std::uint8_t>(seats), 0};
+        for (unsigned seat {0}; seat < seats; ++seat) {
+            table.seat();
+        }
+        table.start();
+        return table;
+    }
+
+    //Opens a strategy file holding just header.
+    bool openStrategy(const Strategy::Header& header) {
+        char path[] {"/tmp/liars-dice-test-XXXXXX"};
+        const int file {mkstemp(path)};
+        if (file < 0) {
+            return false;
+        }
+        const bool written {
+                write(file, &header, sizeof(header)) == sizeof(header)};
+        close(file);
+        Strategy::Table table {};
+        const bool opened {written && table.open(path)};
+        unlink(path);
+        return opened;
+    }
+
+    const Test tests[] {
+        {"game/bidder-leaves-then-challenge", []() -> const char* {
+            Game::Table table {startedTable(3)};
+            if (table.bid(0, 1, 2) != Game::Result::OK) {
+                return "opening bid refused";
+            }
+            table.unseat(0);
+            if (table.currentBidCount() != 0) {
+                return "bid outlived its bidder";
+            }
+            if (table.challenge(1).result != Game::Result::ILLEGAL_CHALLENGE) {
+                return "challenged a withdrawn bid";
+            }
+            if (table.dice(0) != 0 || table.activeMask() != 0b110) {
+                return "leaver back in play";
+            }
+            if (table.bid(1, 1, 2) != Game::Result::OK) {
+                return "next seat could not open";
+            }
+            return nullptr;
+        }},
+        {"game/bidder-leaves-heads-up", []() -> const char* {
+            Game::Table table {startedTable(2)};
+            table.bid(0, 1, 2);
+            table.unseat(0);
+            if (table.currentPhase() != Game::Phase::GAME_OVER
+             || table.winner() != 1) {
+                return "remaining seat did not win";
+            }
+            if (table.challenge(1).result != Game::Result::NOT_PLAYING) {
+                return "challenged after the game ended";
+            }
+            return nullptr;
+        }},
+        {"game/other-seat-leaves-bid-stands", []() -> const char* {
+            Game::Table table {startedTable(3)};
+            table.bid(0, 1, 2);
+            table.unseat(2);
+            if (table.currentBidCount() != 1 || table.currentBidder() != 0) {
+                return "bid withdrawn by someone else leaving";
+            }
+            const Game::ChallengeOutcome outcome {table.challenge(1)};
+            if (outcome.result != Game::Result::OK
+             || table.dice(outcome.loser) != Game::startingDice - 1) {
+                return "challenge did not cost the loser one die";
+            }
+            return nullptr;
+        }},
+        {"strategy/refuses-bad-max-dice", []() -> const char* {
+            Strategy::Header header {};
+            header.maxDice = 1000;
+            header.slotCount = 1;
+            if (openStrategy(header)) {
+                return "opened a file with maxDice out of range";
+            }
+            header.maxDice = 0;
+            if (openStrategy(header)) {
+                return "opened a file with no dice";
+            }
+            return nullptr;
+        }},
+        {"strategy/refuses-truncated", []() -> const char* {
+            Strategy::Header header {};
+            header.maxDice = 1;
+            header.slotCount = Strategy::Layout{1}.slotCount();
+            if (openStrategy(header)) {
+                return "opened a file shorter than its slots";
+            }
+            return nullptr;
+        }},
+    };
+}
+
+int main(int argc, char* argv[]) {
+    const std::string filter {argc > 1 ? argv[1] : ""};
+    unsigned failed {0};
+    for (const Test& test : tests) {
+        if (std::string{test.name}.find(filter) == std::string::npos) {
+            continue;
+        }
+        if (const char* failure {test.run()}) {
+            std::printf("FAIL %s: %s\n", test.name, failure);
+            ++failed;
+        }
+    }
+    return failed != 0;
+}
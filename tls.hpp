@@ -0,0 +1,209 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+
+//Server-side TLS setup that keeps handshakes cheap: ECDHE only (no finite
+//field DH parameters), TLS 1.2 and 1.3, and session resumption so a player
+//reconnecting after a network blip skips the certificate and key exchange.
+namespace Tls {
+    struct TicketKey {
+        std::array<unsigned char, 16> name {};
+        std::array<unsigned char, 32> aesKey {};
+        std::array<unsigned char, 32> hmacKey {};
+    };
+
+    //Keys encrypting session tickets. New tickets use the current key;
+    //tickets under the previous one are still accepted and reissued, so a
+    //rotation never costs anyone who connected within two lifetimes a full
+    //handshake.
+    //
+    //With a path, keys are read from that file (one or two 80 byte keys,
+    //newest first, each a name, an AES key and an HMAC key) and re-read
+    //every lifetime, so every server process pointed at the same file
+    //accepts the others' tickets; something else rotates the file. Without
+    //one they are random and rotated in-process.
+    //
+    //The owner calls rotate() every lifetime, off the handshake path;
+    //handshakes only load the published key set.
+    class TicketKeys {
+        private:
+            //current, previous
+            struct KeySet {
+                std::array<TicketKey, 2> keys {};
+                std::size_t count {0};
+            };
+            //Not lock-free: libstdc++ guards it with a lock bit in the
+            //pointer, held only to bump the count or swap the pointer.
+            //rotate() builds the next set before taking it, so a handshake
+            //never waits on the key file.
+            std::atomic<std::shared_ptr<const KeySet>> published {};
+            const std::string path;
+            const std::chrono::seconds keyLifetime;
+
+            static int dataIndex() {
+                static const int index {SSL_CTX_get_ex_new_index(
+                        0, nullptr, nullptr, nullptr, nullptr)};
+                return index;
+            }
+
+            bool load(KeySet& keySet) const {
+                std::FILE* file {std::fopen(path.c_str(), "rb")};
+                if (file == nullptr) {
+                    return false;
+                }
+                std::array<TicketKey, 2> loaded {};
+                const std::size_t count {
+                        std::fread(loaded.data(), sizeof(TicketKey), 2, file)};
+                std::fclose(file);
+                if (count == 0) {
+                    return false;
+                }
+                keySet.keys = loaded;
+                keySet.count = count;
+                return true;
+            }
+            static void generate(KeySet& keySet) {
+                TicketKey& key {keySet.keys[0]};
+                keySet.keys[1] = key;
+                RAND_bytes(key.name.data(), key.name.size());
+                RAND_bytes(key.aesKey.data(), key.aesKey.size());
+                RAND_bytes(key.hmacKey.data(), key.hmacKey.size());
+                keySet.count = std::min<std::size_t>(keySet.count + 1, 2);
+            }
+
+            static bool setMacKey(EVP_MAC_CTX* mac, TicketKey& key) {
+                char digest[] {"SHA256"};
+                const OSSL_PARAM parameters[] {
+                        OSSL_PARAM_construct_octet_string(
+                                OSSL_MAC_PARAM_KEY,
+                                key.hmacKey.data(),
+                                key.hmacKey.size()),
+                        OSSL_PARAM_construct_utf8_string(
+                                OSSL_MAC_PARAM_DIGEST, digest, 0),
+                        OSSL_PARAM_construct_end()};
+                return EVP_MAC_CTX_set_params(mac, parameters) == 1;
+            }
+
+            //See SSL_CTX_set_tlsext_ticket_key_evp_cb(3): 1 to use the
+            //ticket, 2 to use it and issue a fresh one, 0 for a full
+            //handshake, -1 on error.
+            static int onTicket(
+                    SSL* ssl,
+                    unsigned char* name,
+                    unsigned char* iv,
+                    EVP_CIPHER_CTX* cipher,
+                    EVP_MAC_CTX* mac,
+                    const int encrypting) {
+                const auto* self {static_cast<const TicketKeys*>(
+                        SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), dataIndex()))};
+                const std::shared_ptr<const KeySet> keySet {
+                        self->published.load(std::memory_order_acquire)};
+                std::size_t index {0};
+                if (!encrypting) {
+                    while (index < keySet->count && std::memcmp(
+                            name,
+                            keySet->keys[index].name.data(),
+                            TicketKey{}.name.size()) != 0) {
+                        ++index;
+                    }
+                    if (index == keySet->count) {
+                        return 0;
+                    }
+                }
+                TicketKey key {keySet->keys[index]};
+                if (encrypting) {
+                    std::memcpy(name, key.name.data(), key.name.size());
+                    if (RAND_bytes(iv, EVP_CIPHER_iv_length(
+                            EVP_aes_256_cbc())) != 1) {
+                        return -1;
+                    }
+                    return EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(),
+                            nullptr, key.aesKey.data(), iv) == 1
+                        && setMacKey(mac, key) ? 1 : -1;
+                }
+                if (!setMacKey(mac, key) || EVP_DecryptInit_ex(
+                        cipher, EVP_aes_256_cbc(),
+                        nullptr, key.aesKey.data(), iv) != 1) {
+                    return -1;
+                }
+                return index == 0 ? 1 : 2;
+            }
+
+        public:
+            TicketKeys(std::string path, const std::chrono::seconds lifetime)
+                  : path {std::move(path)},
+                    keyLifetime {lifetime} {}
+            TicketKeys(const TicketKeys&) = delete;
+            TicketKeys& operator=(const TicketKeys&) = delete;
+
+            std::chrono::seconds lifetime() const {
+                return keyLifetime;
+            }
+
+            //Publishes the next key set. Called from one thread at a time;
+            //a file that cannot be read keeps the old keys.
+            void rotate() {
+                const std::shared_ptr<const KeySet> current {
+                        published.load(std::memory_order_acquire)};
+                KeySet next {current ? *current : KeySet{}};
+                if (path.empty()) {
+                    generate(next);
+                }
+                else if (!load(next) && next.count == 0) {
+                    std::fprintf(stderr, "could not read ticket keys from %s, "
+                            "using random ones\n", path.c_str());
+                    generate(next);
+                }
+                published.store(
+                        std::make_shared<const KeySet>(next),
+                        std::memory_order_release);
+            }
+
+            //Must outlive context.
+            void install(SSL_CTX* context) {
+                rotate();
+                SSL_CTX_set_ex_data(context, dataIndex(), this);
+                SSL_CTX_set_tlsext_ticket_key_evp_cb(context, &onTicket);
+            }
+    };
+
+    //ECDHE with X25519 or P-256 for both versions, AEAD ciphers only for
+    //1.2, plus a server-side session cache for 1.2 clients that do not
+    //send tickets. Buffers are only held while a connection has data in
+    //flight.
+    inline bool configure(SSL_CTX* context) {
+        SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+        SSL_CTX_set_options(context, SSL_OP_CIPHER_SERVER_PREFERENCE
+              | SSL_OP_NO_RENEGOTIATION);
+        //One ticket per handshake is enough for one reconnect.
+        SSL_CTX_set_num_tickets(context, 1);
+        static constexpr unsigned char sessionContext[] {"liars-dice"};
+        SSL_CTX_set_session_id_context(
+                context, sessionContext, sizeof(sessionContext) - 1);
+        SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(context, 1 << 16);
+        //Idle connections hand their record buffers (tens of KB) back.
+        SSL_CTX_set_mode(context, SSL_MODE_RELEASE_BUFFERS);
+        return SSL_CTX_set1_groups_list(context, "X25519:P-256") == 1
+            && SSL_CTX_set_cipher_list(context,
+                    "ECDHE-ECDSA-AES128-GCM-SHA256:"
+                    "ECDHE-RSA-AES128-GCM-SHA256:"
+                    "ECDHE-ECDSA-CHACHA20-POLY1305:"
+                    "ECDHE-RSA-CHACHA20-POLY1305:"
+                    "ECDHE-ECDSA-AES256-GCM-SHA384:"
+                    "ECDHE-RSA-AES256-GCM-SHA384") == 1;
+    }
+}